@@ -0,0 +1,204 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * What it does ?
+ * Convert discards of the blkparse text output into the replay file
+ * of test-discard --replay. Only the events of one action are taken,
+ * queued (Q) by default, which are the discards as the filesystem or
+ * fstrim sent them before the block layer split or merged them.
+ *
+ * usage:
+ *	blk2replay [-a action] [-d major,minor] <replay file> [blkparse output]
+ *
+ *	-a action Take the events of the action (Q)
+ *	-d major,minor Take the events of this device only
+ *
+ *	blkparse output is read from the standard input by default:
+ *	blkparse -i sda | blk2replay sda.replay
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "libs/replay.h"
+
+#define SECTOR_SIZE	512
+
+struct event {
+	struct replay_rec rec;
+	uint64_t seq;		/* order in the input */
+};
+
+/**
+ * Order by time, events of the same time as they came
+ */
+int cmp_events(const void *a, const void *b) {
+	const struct event *x = a, *y = b;
+
+	if (x->rec.time != y->rec.time)
+		return (x->rec.time > y->rec.time) -
+		       (x->rec.time < y->rec.time);
+	return (x->seq > y->seq) - (x->seq < y->seq);
+} /* cmp_events */
+
+
+/**
+ * Parse one line of blkparse output, the default format is
+ * "maj,min cpu seq sec.nsec pid action rwbs sector + sectors [proc]".
+ * Returns 1 for a discard of the action on the device, 0 otherwise.
+ */
+int parse_line(
+	const char *line,
+	const char *action,
+	int major,
+	int minor,
+	struct replay_rec *rec)
+{
+	unsigned maj, min, cpu, seq, pid;
+	unsigned long long sec, sector, sectors;
+	char frac[16], act[4], rwbs[8];
+	uint64_t ns = 0;
+	int i;
+
+	if (sscanf(line, "%u,%u %u %u %llu.%15[0-9] %u %3s %7s %llu + %llu",
+		   &maj, &min, &cpu, &seq, &sec, frac, &pid, act, rwbs,
+		   &sector, &sectors) != 11)
+		return 0;
+
+	if ((strcmp(act, action) != 0) || (strchr(rwbs, 'D') == NULL) ||
+	    (sectors == 0))
+		return 0;
+
+	if ((major >= 0) &&
+	    ((maj != (unsigned)major) || (min != (unsigned)minor)))
+		return 0;
+
+	/* fraction of the second, in nanoseconds whatever its digits */
+	for (i = 0; i < 9; i++)
+		ns = ns * 10 + ((i < (int)strlen(frac)) ? frac[i] - '0' : 0);
+
+	rec->time = sec * 1000000000ULL + ns;
+	rec->offset = sector * SECTOR_SIZE;
+	rec->length = sectors * SECTOR_SIZE;
+	return 1;
+} /* parse_line */
+
+
+int main (int argc, char **argv) {
+	struct replay_header hdr;
+	struct event *events = NULL, *tmp;
+	char *action = "Q", *input = NULL, line[512];
+	size_t n = 0, size = 0, i;
+	int c, major = -1, minor = -1, ret = EXIT_FAILURE;
+	uint64_t first;
+	FILE *in = stdin, *out;
+
+	while ((c = getopt(argc, argv, "a:d:")) != EOF) {
+		switch (c) {
+			case 'a':
+				action = optarg;
+				break;
+			case 'd':
+				if (sscanf(optarg, "%d,%d", &major,
+					   &minor) != 2) {
+					fprintf(stderr,"Device must be "
+						"major,minor\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+
+	if ((argc - optind < 1) || (argc - optind > 2)) {
+		fprintf(stderr,"%s [-a action] [-d major,minor] "
+			"<replay file> [blkparse output]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc - optind == 2)
+		input = argv[optind + 1];
+
+	if (input && ((in = fopen(input, "r")) == NULL)) {
+		perror("Opening blkparse output");
+		return EXIT_FAILURE;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		if (n == size) {
+			size = size ? size * 2 : 4096;
+			if ((tmp = realloc(events,
+					   size * sizeof(*events))) == NULL) {
+				perror("realloc");
+				goto out;
+			}
+			events = tmp;
+		}
+		if (parse_line(line, action, major, minor, &events[n].rec)) {
+			events[n].seq = n;
+			n++;
+		}
+	}
+	if (ferror(in)) {
+		perror("Reading blkparse output");
+		goto out;
+	}
+
+	if (n == 0) {
+		fprintf(stderr,"No discards found\n");
+		goto out;
+	}
+
+	/* blkparse merges the CPUs by time, but do not count on it */
+	qsort(events, n, sizeof(*events), cmp_events);
+
+	if ((out = fopen(argv[optind], "w")) == NULL) {
+		perror("Opening replay file");
+		goto out;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = REPLAY_MAGIC;
+	hdr.version = REPLAY_VERSION;
+	hdr.rec_size = sizeof(struct replay_rec);
+	hdr.count = n;
+	fwrite(&hdr, sizeof(hdr), 1, out);
+
+	first = events[0].rec.time;
+	for (i = 0; i < n; i++) {
+		events[i].rec.time -= first;
+		fwrite(&events[i].rec, sizeof(struct replay_rec), 1, out);
+	}
+
+	c = ferror(out);
+	if ((fclose(out) == EOF) || c) {
+		perror("Writing replay file");
+		goto out;
+	}
+
+	fprintf(stderr,"%zu discards in %lf s\n", n,
+		(events[n - 1].rec.time) / 1000000000.0);
+	ret = EXIT_SUCCESS;
+out:
+	free(events);
+	if (input)
+		fclose(in);
+	return ret;
+} /* main */
@@ -0,0 +1,113 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "arena.h"
+
+void arena_init(struct arena *arena, size_t obj_size, size_t chunk_objs)
+{
+	/* free objects hold the free list pointer */
+	if (obj_size < sizeof(void *))
+		obj_size = sizeof(void *);
+	/* keep objects aligned */
+	obj_size = (obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	arena->obj_size = obj_size;
+	arena->chunk_objs = chunk_objs;
+	arena->chunks = NULL;
+	arena->cur = NULL;
+	arena->cur_used = 0;
+	arena->free_list = NULL;
+	arena->nchunks = 0;
+	arena->used = 0;
+	arena->peak = 0;
+} /* arena_init */
+
+
+/**
+ * Get object from the free list, or carve a new one from
+ * the current chunk. Returns NULL if we run out of memory.
+ */
+void *arena_alloc(struct arena *arena)
+{
+	struct arena_chunk *chunk;
+	void *obj;
+
+	if ((obj = arena->free_list) != NULL) {
+		arena->free_list = *(void **)obj;
+		goto out;
+	}
+
+	if (!arena->cur || (arena->cur_used == arena->chunk_objs)) {
+		if (arena->cur && arena->cur->next) {
+			/* reuse chunk kept by arena_reset() */
+			chunk = arena->cur->next;
+		} else if (!arena->cur && arena->chunks) {
+			chunk = arena->chunks;
+		} else {
+			chunk = malloc(sizeof(*chunk) +
+				       arena->chunk_objs * arena->obj_size);
+			if (chunk == NULL) {
+				perror("malloc");
+				return NULL;
+			}
+			/* cur is the last chunk, or there is none */
+			chunk->next = NULL;
+			if (arena->cur)
+				arena->cur->next = chunk;
+			else
+				arena->chunks = chunk;
+			arena->nchunks++;
+		}
+		arena->cur = chunk;
+		arena->cur_used = 0;
+	}
+
+	obj = arena->cur->data + arena->cur_used * arena->obj_size;
+	arena->cur_used++;
+out:
+	if (++arena->used > arena->peak)
+		arena->peak = arena->used;
+	return obj;
+} /* arena_alloc */
+
+
+void arena_free(struct arena *arena, void *obj)
+{
+	*(void **)obj = arena->free_list;
+	arena->free_list = obj;
+	arena->used--;
+} /* arena_free */
+
+
+/**
+ * Forget all objects. Chunks are kept and carved again from
+ * the first one.
+ */
+void arena_reset(struct arena *arena)
+{
+	arena->cur = NULL;
+	arena->cur_used = 0;
+	arena->free_list = NULL;
+	arena->used = 0;
+} /* arena_reset */
+
+
+void arena_destroy(struct arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena_init(arena, arena->obj_size, arena->chunk_objs);
+} /* arena_destroy */
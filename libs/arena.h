@@ -0,0 +1,53 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Arena of fixed size objects. Objects are carved from big chunks,
+ * freed objects are kept on an intrusive free list and reused by the
+ * next allocation. Reset forgets all objects at once and keeps the
+ * chunks for reuse, so it costs O(1).
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	char data[];
+};
+
+struct arena {
+	size_t obj_size;
+	size_t chunk_objs;		/* objects per chunk */
+	struct arena_chunk *chunks;	/* all chunks in allocation order */
+	struct arena_chunk *cur;	/* chunk we are carving from */
+	size_t cur_used;		/* objects carved from cur */
+	void *free_list;
+	size_t nchunks;
+	size_t used;			/* objects in use */
+	size_t peak;			/* max objects in use */
+};
+
+extern void arena_init(struct arena *arena, size_t obj_size,
+		       size_t chunk_objs);
+extern void *arena_alloc(struct arena *arena);
+extern void arena_free(struct arena *arena, void *obj);
+extern void arena_reset(struct arena *arena);
+extern void arena_destroy(struct arena *arena);
+
+/**
+ * Memory allocated for chunks in bytes
+ */
+static inline size_t arena_memory(struct arena *arena)
+{
+	return arena->nchunks * (sizeof(struct arena_chunk) +
+				 arena->chunk_objs * arena->obj_size);
+}
+
+#endif /* _ARENA_H */
@@ -0,0 +1,84 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+void hist_init(struct histogram *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+} /* hist_init */
+
+
+/**
+ * Add all values recorded in src to dst
+ */
+void hist_merge(struct histogram *dst, const struct histogram *src)
+{
+	unsigned i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+} /* hist_merge */
+
+
+/**
+ * Value representing the bucket, that is the middle
+ * of the range of values falling into it
+ */
+uint64_t hist_value(unsigned bucket)
+{
+	unsigned shift;
+	uint64_t low;
+
+	if (bucket < HIST_SUB)
+		return bucket;
+
+	shift = (bucket >> HIST_SUB_BITS) - 1;
+	low = (uint64_t)(HIST_SUB + (bucket & (HIST_SUB - 1))) << shift;
+
+	return low + ((1ULL << shift) >> 1);
+} /* hist_value */
+
+
+/**
+ * Get the rank-th smallest recorded value, ranks start at 1
+ */
+uint64_t hist_rank(const struct histogram *hist, uint64_t rank)
+{
+	uint64_t seen = 0;
+	unsigned i;
+
+	if (hist->count == 0)
+		return 0;
+
+	if (rank < 1)
+		rank = 1;
+	if (rank > hist->count)
+		rank = hist->count;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			return hist_value(i);
+	}
+
+	return hist_value(HIST_BUCKETS - 1);
+} /* hist_rank */
+
+
+/**
+ * Get the value below which pct percent of recorded values fall
+ */
+uint64_t hist_percentile(const struct histogram *hist, double pct)
+{
+	return hist_rank(hist, (uint64_t)((pct / 100.0) * hist->count + 0.5));
+} /* hist_percentile */
@@ -0,0 +1,70 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Log-bucketed latency histogram in the spirit of HdrHistogram. Every
+ * power of two is split into HIST_SUB linear buckets, so the relative
+ * error of any recorded value is below 1/HIST_SUB. Memory is fixed,
+ * recording a value is O(1) and histograms merge by adding buckets.
+ */
+
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS	6
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS	40	/* values are capped at 2^40 - 1 (~18 min in ns) */
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+	uint64_t count;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+/**
+ * Map value to its bucket. Values below HIST_SUB have a bucket
+ * each, bigger values are indexed by their most significant bit
+ * and the HIST_SUB_BITS bits below it.
+ */
+static inline unsigned hist_bucket(uint64_t value)
+{
+	unsigned msb, shift;
+
+	if (value >= (1ULL << HIST_MAX_BITS))
+		value = (1ULL << HIST_MAX_BITS) - 1;
+
+	if (value < HIST_SUB)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+	shift = msb - HIST_SUB_BITS;
+
+	return ((shift + 1) << HIST_SUB_BITS) +
+	       ((value >> shift) & (HIST_SUB - 1));
+}
+
+/**
+ * Record the value. The bucket is stored relaxed atomic, so another
+ * thread can read the buckets while they are being recorded.
+ */
+static inline void hist_add(struct histogram *hist, uint64_t value)
+{
+	uint64_t *bucket = &hist->buckets[hist_bucket(value)];
+
+	__atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+	hist->count++;
+}
+
+extern void hist_init(struct histogram *hist);
+extern void hist_merge(struct histogram *dst, const struct histogram *src);
+extern uint64_t hist_value(unsigned bucket);
+extern uint64_t hist_rank(const struct histogram *hist, uint64_t rank);
+extern uint64_t hist_percentile(const struct histogram *hist, double pct);
+
+#endif /* _HISTOGRAM_H */
@@ -0,0 +1,133 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/fs.h>
+#include <linux/nvme_ioctl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <limits.h>
+#include <endian.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nvme.h"
+
+#define NVME_CMD_DSM	0x09
+#define NVME_DSM_AD	(1 << 2)	/* attribute deallocate */
+
+/**
+ * Offset of the partition in the whole namespace in bytes, the sysfs
+ * start attribute is in 512 byte sectors and partitions only have it
+ */
+static int nvme_part_start(int fd, uint64_t *start)
+{
+	char path[PATH_MAX];
+	unsigned long long sectors;
+	struct stat sb;
+	FILE *f;
+	int ret;
+
+	*start = 0;
+	if (fstat(fd, &sb) == -1)
+		return -1;
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/start",
+		 major(sb.st_rdev), minor(sb.st_rdev));
+	if ((f = fopen(path, "r")) == NULL)
+		return (errno == ENOENT) ? 0 : -1;
+
+	ret = fscanf(f, "%llu", &sectors);
+	fclose(f);
+	if (ret != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*start = sectors * 512;
+	return 0;
+} /* nvme_part_start */
+
+
+/**
+ * Find the namespace, its logical block size and where in it the
+ * opened block device starts, fails with ENOTTY when it is not
+ * an NVMe namespace or its partition
+ */
+int nvme_ns_open(struct nvme_ns *ns, int fd)
+{
+	int ret, lbs;
+
+	if ((ret = ioctl(fd, NVME_IOCTL_ID)) < 0)
+		return -1;
+	ns->fd = fd;
+	ns->nsid = ret;
+
+	if (ioctl(fd, BLKSSZGET, &lbs) == -1)
+		return -1;
+	for (ns->lba_shift = 0; (1 << ns->lba_shift) < lbs; ns->lba_shift++)
+		;
+
+	/* the namespace knows nothing of partitions, DSM takes its LBAs */
+	if (nvme_part_start(fd, &ns->start) == -1)
+		return -1;
+	if (ns->start & ((1ULL << ns->lba_shift) - 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+} /* nvme_ns_open */
+
+
+/**
+ * Deallocate nr ranges {offset, length} in bytes by one DSM command.
+ * Offsets are relative to the opened device and get shifted by the
+ * partition start. The ranges must be aligned to the logical block
+ * size, buf is the space for NVME_DSM_MAX_RANGES descriptors.
+ */
+int nvme_dsm(const struct nvme_ns *ns, struct nvme_dsm_range *buf,
+	     uint64_t (*ranges)[2], int nr)
+{
+	struct nvme_passthru_cmd cmd;
+	uint64_t nlb;
+	int i, ret;
+
+	if ((nr < 1) || (nr > NVME_DSM_MAX_RANGES)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		nlb = ranges[i][1] >> ns->lba_shift;
+		if (nlb > UINT32_MAX) {
+			errno = EINVAL;
+			return -1;
+		}
+		buf[i].cattr = 0;
+		buf[i].nlb = htole32(nlb);
+		buf[i].slba = htole64((ns->start + ranges[i][0]) >>
+				      ns->lba_shift);
+	}
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.opcode = NVME_CMD_DSM;
+	cmd.nsid = ns->nsid;
+	cmd.addr = (uintptr_t)buf;
+	cmd.data_len = nr * sizeof(*buf);
+	cmd.cdw10 = nr - 1;
+	cmd.cdw11 = NVME_DSM_AD;
+
+	/* positive return value is the NVMe status of the command */
+	if ((ret = ioctl(ns->fd, NVME_IOCTL_IO_CMD, &cmd)) > 0) {
+		errno = EIO;
+		return -1;
+	}
+	return ret;
+} /* nvme_dsm */
@@ -0,0 +1,40 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * NVMe Dataset Management deallocate issued by the passthrough ioctl
+ * on the namespace. Unlike BLKDISCARD one command carries up to 256
+ * ranges, which need not be contiguous, the way the driver batches
+ * discards of scattered blocks.
+ */
+
+#ifndef _NVME_H
+#define _NVME_H
+
+#include <stdint.h>
+
+#define NVME_DSM_MAX_RANGES	256
+
+/* range descriptor of the DSM command, little endian */
+struct nvme_dsm_range {
+	uint32_t cattr;		/* context attributes */
+	uint32_t nlb;		/* number of logical blocks */
+	uint64_t slba;		/* starting logical block */
+};
+
+struct nvme_ns {
+	int fd;
+	uint32_t nsid;
+	unsigned lba_shift;	/* log2 of the logical block size */
+	uint64_t start;		/* partition offset in the namespace, bytes */
+};
+
+extern int nvme_ns_open(struct nvme_ns *ns, int fd);
+extern int nvme_dsm(const struct nvme_ns *ns, struct nvme_dsm_range *buf,
+		    uint64_t (*ranges)[2], int nr);
+
+#endif /* _NVME_H */
@@ -0,0 +1,186 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "op.h"
+#include "prng.h"
+#include "timer.h"
+
+#ifndef BLOCK_URING_CMD_DISCARD
+#define BLOCK_URING_CMD_DISCARD _IO(0x12, 0)
+#endif
+
+static int discard_issue(int fd, uint64_t *range)
+{
+	return ioctl(fd, BLKDISCARD, range);
+}
+
+static void discard_prep_sqe(struct io_uring_sqe *sqe, int fd,
+			     uint64_t *range)
+{
+	sqe->opcode = IORING_OP_URING_CMD;
+	sqe->fd = fd;
+	sqe->cmd_op = BLOCK_URING_CMD_DISCARD;
+	sqe->addr = range[0];
+	sqe->addr3 = range[1];
+}
+
+static int secdiscard_issue(int fd, uint64_t *range)
+{
+	return ioctl(fd, BLKSECDISCARD, range);
+}
+
+static int zeroout_issue(int fd, uint64_t *range)
+{
+	return ioctl(fd, BLKZEROOUT, range);
+}
+
+static int punch_issue(int fd, uint64_t *range)
+{
+	return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			 range[0], range[1]);
+}
+
+static void punch_prep_sqe(struct io_uring_sqe *sqe, int fd,
+			   uint64_t *range)
+{
+	sqe->opcode = IORING_OP_FALLOCATE;
+	sqe->fd = fd;
+	sqe->off = range[0];
+	sqe->addr = range[1];
+	sqe->len = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+}
+
+static int null_issue(int fd, uint64_t *range)
+{
+	return 0;
+}
+
+static void null_prep_sqe(struct io_uring_sqe *sqe, int fd,
+			  uint64_t *range)
+{
+	sqe->opcode = IORING_OP_NOP;
+}
+
+/*
+ * Simulated device. Every worker draws the latencies from its own
+ * generator, the slots of the queue are shared.
+ */
+static struct {
+	int dist;
+	uint64_t latency;	/* ns */
+	int depth;		/* 0 for unlimited */
+	uint64_t seed;
+	unsigned workers;	/* generators seeded so far */
+	sem_t slots;
+} sim;
+
+static __thread struct prng sim_rng;
+static __thread int sim_seeded;
+
+/**
+ * Set up the simulated device before the first operation
+ */
+int op_sim_setup(int dist, uint64_t latency, int depth, uint64_t seed)
+{
+	sim.dist = dist;
+	sim.latency = latency;
+	sim.depth = depth;
+	sim.seed = seed;
+	sim.workers = 0;
+
+	if (depth && (sem_init(&sim.slots, 0, depth) == -1)) {
+		perror("sem_init");
+		return -1;
+	}
+	return 0;
+} /* op_sim_setup */
+
+
+static uint64_t sim_latency(void)
+{
+	double u;
+
+	if (!sim_seeded) {
+		prng_seed(&sim_rng, sim.seed +
+			  __atomic_fetch_add(&sim.workers, 1, __ATOMIC_RELAXED));
+		sim_seeded = 1;
+	}
+
+	switch (sim.dist) {
+	case OP_SIM_UNIFORM:
+		return prng_bounded(&sim_rng, 2 * sim.latency + 1);
+	case OP_SIM_EXP:
+		u = prng_double(&sim_rng);
+		return -log(1 - u) * sim.latency;
+	default:
+		return sim.latency;
+	}
+}
+
+static int sim_issue(int fd, uint64_t *range)
+{
+	uint64_t deadline, now, ns;
+	struct timespec ts;
+
+	if (sim.depth)
+		while (sem_wait(&sim.slots) == -1)
+			;
+
+	deadline = timer_now() + timer_ticks(sim_latency());
+
+	/* sleep the most of it and spin the rest to be precise */
+	while ((now = timer_now()) < deadline) {
+		ns = timer_ns(deadline - now);
+		if (ns <= 50000)
+			continue;
+		ns -= 50000;
+		ts.tv_sec = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		nanosleep(&ts, NULL);
+	}
+
+	if (sim.depth)
+		sem_post(&sim.slots);
+	return 0;
+}
+
+static const struct op_backend backends[] = {
+	{"discard", "Ioctl BLKDISCARD", 0, 0, discard_issue, discard_prep_sqe},
+	{"secdiscard", "Ioctl BLKSECDISCARD", 0, 0, secdiscard_issue, NULL},
+	{"zeroout", "Ioctl BLKZEROOUT", 0, 0, zeroout_issue, NULL},
+	{"punch", "fallocate", 1, 0, punch_issue, punch_prep_sqe},
+	{"null", "null", 1, 1, null_issue, null_prep_sqe},
+	{"sim", "sim", 1, 1, sim_issue, NULL},
+	{NULL, NULL, 0, 0, NULL, NULL},
+};
+
+
+/**
+ * Find the operation by name
+ */
+const struct op_backend *op_find(const char *name)
+{
+	const struct op_backend *op;
+
+	for (op = backends; op->name; op++)
+		if (strcmp(op->name, name) == 0)
+			return op;
+
+	fprintf(stderr, "Unknown operation %s\n", name);
+	return NULL;
+} /* op_find */
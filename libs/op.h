@@ -0,0 +1,51 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Operations freeing the space of a range of the device. All of them
+ * are timed by the same loops, the operation is chosen by name:
+ *
+ *  discard    - BLKDISCARD ioctl
+ *  secdiscard - BLKSECDISCARD ioctl
+ *  zeroout    - BLKZEROOUT ioctl, may be offloaded to WRITE ZEROES
+ *  punch      - fallocate(FALLOC_FL_PUNCH_HOLE), also on regular files
+ *  null       - nothing, to measure the cost of the tool itself
+ *  sim        - simulated device, waits for a latency drawn from the
+ *               distribution set by op_sim_setup() with at most depth
+ *               operations served at once
+ */
+
+#ifndef _OP_H
+#define _OP_H
+
+#include <stdint.h>
+
+#include "uring.h"
+
+struct op_backend {
+	const char *name;
+	const char *call;	/* name of the call for error messages */
+	int files;		/* works on regular files too */
+	int nodev;		/* does not touch the device at all */
+
+	/* issue the operation on the range {offset, length} */
+	int (*issue)(int fd, uint64_t *range);
+
+	/* fill the sqe with it, NULL if not supported by io_uring */
+	void (*prep_sqe)(struct io_uring_sqe *sqe, int fd, uint64_t *range);
+};
+
+/* latency distributions of the simulated device */
+#define OP_SIM_FIXED	0
+#define OP_SIM_UNIFORM	1	/* uniform in [0, 2 * latency] */
+#define OP_SIM_EXP	2	/* exponential with the mean latency */
+
+extern const struct op_backend *op_find(const char *name);
+extern int op_sim_setup(int dist, uint64_t latency, int depth,
+			uint64_t seed);
+
+#endif /* _OP_H */
@@ -0,0 +1,197 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "pattern.h"
+
+/* zeta(n) is summed up to this and integrated from there on */
+#define ZETA_EXACT	1000000ULL
+
+static const char *names[] = {"uniform", "strided", "zipf", "varlen"};
+
+const char *pattern_name(int type)
+{
+	return names[type];
+}
+
+static long long uniform_next(struct pattern *p, struct tracker *t,
+			      unsigned long long *count)
+{
+	*count = 1;
+	return tracker_next(t);
+}
+
+/**
+ * Walk the lane with the stride, when it hits the end of the
+ * device continue with the next lane one block further
+ */
+static long long strided_next(struct pattern *p, struct tracker *t,
+			      unsigned long long *count)
+{
+	unsigned long long block;
+
+	if (p->next >= p->nblocks) {
+		p->lane = (p->lane + 1) % p->stride;
+		p->next = p->lane;
+	}
+	block = p->next;
+	p->next += p->stride;
+
+	*count = 1;
+	return tracker_claim(t, block);
+}
+
+/**
+ * Zipfian rank by the method of Gray et al. "Quickly generating
+ * billion-record synthetic databases", which YCSB uses too. Hot
+ * blocks already discarded give way to the next free ones.
+ */
+static long long zipf_next(struct pattern *p, struct tracker *t,
+			   unsigned long long *count)
+{
+	unsigned long long block;
+	double u = prng_double(&p->rng), uz = u * p->zetan;
+
+	if (uz < 1.0)
+		block = 0;
+	else if (uz < p->half_pow)
+		block = 1;
+	else
+		block = p->nblocks * pow(p->eta * u - p->eta + 1, p->alpha);
+	if (block >= p->nblocks)
+		block = p->nblocks - 1;
+
+	*count = 1;
+	return tracker_claim(t, block);
+}
+
+/**
+ * Extent starts at a free block picked by the tracker and takes
+ * the following free blocks up to its random length
+ */
+static long long varlen_next(struct pattern *p, struct tracker *t,
+			     unsigned long long *count)
+{
+	unsigned long long len, n;
+	long long block;
+
+	if (p->conf.dist == VARLEN_EXP)
+		len = 1 + (unsigned long long)(-log(1 - prng_double(&p->rng)) *
+					       (p->mean - 1));
+	else
+		len = 1 + prng_bounded(&p->rng, 2 * p->mean - 1);
+
+	if ((block = tracker_next(t)) == -1)
+		return -1;
+
+	for (n = 1; (n < len) && (block + n < p->nblocks); n++) {
+		if (tracker_test(t, block + n) ||
+		    (tracker_claim(t, block + n) == -1))
+			break;
+	}
+
+	*count = n;
+	return block;
+}
+
+static double zeta(unsigned long long n, double theta)
+{
+	unsigned long long i, exact = (n < ZETA_EXACT) ? n : ZETA_EXACT;
+	double sum = 0;
+
+	for (i = 1; i <= exact; i++)
+		sum += pow(i, -theta);
+
+	/* the rest by the integral with the end point correction */
+	if (n > exact)
+		sum += (pow(n, 1 - theta) - pow(exact, 1 - theta)) /
+		       (1 - theta) + (pow(n, -theta) - pow(exact, -theta)) / 2;
+
+	return sum;
+}
+
+struct pattern *pattern_create(const struct pattern_conf *conf, uint64_t seed)
+{
+	struct pattern *p;
+
+	if ((p = calloc(1, sizeof(*p))) == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	p->conf = *conf;
+	prng_seed(&p->rng, seed);
+
+	switch (conf->type) {
+	case PATTERN_STRIDED:
+		p->next_block = strided_next;
+		break;
+	case PATTERN_ZIPF:
+		p->next_block = zipf_next;
+		break;
+	case PATTERN_VARLEN:
+		p->next_block = varlen_next;
+		break;
+	default:
+		p->next_block = uniform_next;
+		break;
+	}
+
+	return p;
+} /* pattern_create */
+
+
+/**
+ * Start the pattern over for the tracker of the new step
+ */
+int pattern_reset(struct pattern *p, struct tracker *t,
+		  unsigned long long record_size)
+{
+	double zeta2;
+
+	if ((p->conf.type != PATTERN_UNIFORM) &&
+	    ((t->ops->claim == NULL) || (t->ops->test == NULL))) {
+		fprintf(stderr, "Tracker %s supports only the uniform "
+			"pattern\n", t->ops->name);
+		return -1;
+	}
+
+	p->nblocks = t->nblocks;
+	p->lane = 0;
+	p->next = 0;
+
+	p->stride = p->conf.bytes / record_size;
+	if (p->stride == 0)
+		p->stride = 1;
+
+	p->mean = (double)p->conf.bytes / record_size;
+	if (p->mean < 1)
+		p->mean = 1;
+
+	if ((p->conf.type == PATTERN_ZIPF) && p->nblocks) {
+		zeta2 = zeta(2, p->conf.theta);
+		p->zetan = zeta(p->nblocks, p->conf.theta);
+		p->alpha = 1 / (1 - p->conf.theta);
+		p->eta = (1 - pow(2.0 / p->nblocks, 1 - p->conf.theta)) /
+			 (1 - zeta2 / p->zetan);
+		p->half_pow = 1 + pow(0.5, p->conf.theta);
+	}
+
+	return 0;
+} /* pattern_reset */
+
+
+void pattern_destroy(struct pattern *p)
+{
+	free(p);
+} /* pattern_destroy */
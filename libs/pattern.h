@@ -0,0 +1,76 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Generators of the blocks discarded in random IO mode. Every generator
+ * picks the blocks through the tracker, so the blocks are discarded
+ * only once and the prep logic rewrites just what was discarded:
+ *
+ *  uniform - uniformly random blocks, what the tracker picks
+ *  strided - every stride bytes, then the same shifted by one block
+ *  zipf    - Zipfian over the block numbers, the first ones are hot
+ *  varlen  - uniformly placed extents of random length
+ *
+ * All but uniform need a tracker which can claim given blocks.
+ */
+
+#ifndef _PATTERN_H
+#define _PATTERN_H
+
+#include <stdint.h>
+
+#include "prng.h"
+#include "tracker.h"
+
+#define PATTERN_UNIFORM	0
+#define PATTERN_STRIDED	1
+#define PATTERN_ZIPF	2
+#define PATTERN_VARLEN	3
+
+/* distributions of the varlen extent length */
+#define VARLEN_UNIFORM	0	/* uniform in [1, 2 * mean - 1] blocks */
+#define VARLEN_EXP	1	/* one plus exponential, with the mean */
+
+struct pattern_conf {
+	int type;			/* PATTERN_* */
+	unsigned long long bytes;	/* stride or mean extent length */
+	double theta;			/* zipf skew, in (0, 1) */
+	int dist;			/* VARLEN_* */
+};
+
+struct pattern {
+	struct pattern_conf conf;
+	struct prng rng;
+	unsigned long long nblocks;
+	unsigned long long stride;	/* in blocks */
+	unsigned long long lane, next;	/* strided position */
+	double mean;			/* varlen mean in blocks */
+	double zetan, eta, alpha;	/* zipf constants */
+	double half_pow;		/* 1 + 0.5^theta */
+
+	long long (*next_block)(struct pattern *p, struct tracker *t,
+				unsigned long long *count);
+};
+
+extern const char *pattern_name(int type);
+extern struct pattern *pattern_create(const struct pattern_conf *conf,
+				      uint64_t seed);
+extern int pattern_reset(struct pattern *p, struct tracker *t,
+			 unsigned long long record_size);
+extern void pattern_destroy(struct pattern *p);
+
+/**
+ * Pick the next extent, count is set to its number of blocks.
+ * Returns the first block of it or -1 on error.
+ */
+static inline long long pattern_next(struct pattern *p, struct tracker *t,
+				     unsigned long long *count)
+{
+	return p->next_block(p, t, count);
+}
+
+#endif /* _PATTERN_H */
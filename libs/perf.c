@@ -0,0 +1,115 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "perf.h"
+
+const char *perf_names[PERF_NR] = {
+	"cycles",
+	"instructions",
+	"context switches",
+	"cpu migrations",
+	"page faults",
+};
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} events[PERF_NR] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static int open_event(int i, int exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_hv = 1;
+	attr.exclude_kernel = exclude_kernel;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Open all the counters which are available, counting the kernel too
+ * if we are allowed to. Returns the number of counters opened.
+ */
+int perf_open(struct perf *perf)
+{
+	int i, n = 0;
+
+	for (i = 0; i < PERF_NR; i++) {
+		perf->fd[i] = open_event(i, 0);
+		if ((perf->fd[i] == -1) && (errno == EACCES))
+			perf->fd[i] = open_event(i, 1);
+		if (perf->fd[i] != -1)
+			n++;
+	}
+	return n;
+} /* perf_open */
+
+
+void perf_start(struct perf *perf)
+{
+	int i;
+
+	for (i = 0; i < PERF_NR; i++) {
+		if (perf->fd[i] == -1)
+			continue;
+		ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+} /* perf_start */
+
+
+/**
+ * Stop counting and read the counters, the threads counted
+ * must have exited already
+ */
+void perf_stop(struct perf *perf, struct perf_counts *counts)
+{
+	int i;
+
+	memset(counts, 0, sizeof(*counts));
+	for (i = 0; i < PERF_NR; i++) {
+		if (perf->fd[i] == -1)
+			continue;
+		ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(perf->fd[i], &counts->val[i], sizeof(uint64_t)) ==
+		    sizeof(uint64_t))
+			counts->valid |= 1 << i;
+	}
+} /* perf_stop */
+
+
+void perf_close(struct perf *perf)
+{
+	int i;
+
+	for (i = 0; i < PERF_NR; i++) {
+		if (perf->fd[i] != -1)
+			close(perf->fd[i]);
+		perf->fd[i] = -1;
+	}
+} /* perf_close */
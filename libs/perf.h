@@ -0,0 +1,45 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * CPU cost of the test itself counted by perf_event_open(). Counters
+ * are opened on the calling thread and inherited by the threads it
+ * creates afterwards, whose counts are added when they exit. Counters
+ * the machine does not have (hardware ones in most VMs) are left out.
+ */
+
+#ifndef _PERF_H
+#define _PERF_H
+
+#include <stdint.h>
+
+enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CTX_SWITCHES,
+	PERF_MIGRATIONS,
+	PERF_FAULTS,
+	PERF_NR,
+};
+
+struct perf {
+	int fd[PERF_NR];	/* -1 if not available */
+};
+
+struct perf_counts {
+	uint64_t val[PERF_NR];
+	unsigned valid;		/* bit mask of the counters read */
+};
+
+extern const char *perf_names[PERF_NR];
+
+extern int perf_open(struct perf *perf);
+extern void perf_start(struct perf *perf);
+extern void perf_stop(struct perf *perf, struct perf_counts *counts);
+extern void perf_close(struct perf *perf);
+
+#endif /* _PERF_H */
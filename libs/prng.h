@@ -0,0 +1,76 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * xoshiro256** pseudorandom generator by David Blackman and Sebastiano
+ * Vigna, seeded through splitmix64. It is fast, has 64 bit output and
+ * gives the same sequence for the same seed on every machine.
+ */
+
+#ifndef _PRNG_H
+#define _PRNG_H
+
+#include <stdint.h>
+
+struct prng {
+	uint64_t s[4];
+};
+
+static inline uint64_t prng_rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t prng_next(struct prng *rng)
+{
+	uint64_t *s = rng->s;
+	const uint64_t result = prng_rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = prng_rotl(s[3], 45);
+
+	return result;
+}
+
+/**
+ * Unbiased random number in [0, max) using Lemire's multiply
+ * and shift method, the rejection is very rare for small max
+ */
+static inline uint64_t prng_bounded(struct prng *rng, uint64_t max)
+{
+	__uint128_t m;
+	uint64_t low, threshold;
+
+	m = (__uint128_t)prng_next(rng) * max;
+	low = (uint64_t)m;
+	if (low < max) {
+		threshold = -max % max;
+		while (low < threshold) {
+			m = (__uint128_t)prng_next(rng) * max;
+			low = (uint64_t)m;
+		}
+	}
+
+	return m >> 64;
+}
+
+/**
+ * Uniform double in [0, 1) from the top 53 bits
+ */
+static inline double prng_double(struct prng *rng)
+{
+	return (prng_next(rng) >> 11) * (1.0 / (1ULL << 53));
+}
+
+extern void prng_seed(struct prng *rng, uint64_t seed);
+
+#endif /* _PRNG_H */
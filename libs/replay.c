@@ -0,0 +1,101 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "replay.h"
+
+/**
+ * Map the trace and check it. The check reads every record, so the
+ * whole trace is in memory before the replay starts.
+ */
+int replay_open(struct replay *replay, const char *path)
+{
+	const struct replay_header *hdr;
+	const struct replay_rec *rec;
+	struct stat sb;
+	uint64_t i;
+
+	memset(replay, 0, sizeof(*replay));
+
+	if ((replay->fd = open(path, O_RDONLY)) == -1) {
+		perror("Opening replay file");
+		return -1;
+	}
+
+	if (fstat(replay->fd, &sb) == -1) {
+		perror("stat");
+		goto err_close;
+	}
+
+	if (sb.st_size < (off_t)sizeof(struct replay_header))
+		goto err_format;
+
+	replay->map_size = sb.st_size;
+	replay->map = mmap(NULL, replay->map_size, PROT_READ,
+			   MAP_SHARED | MAP_POPULATE, replay->fd, 0);
+	if (replay->map == MAP_FAILED) {
+		perror("Mapping replay file");
+		replay->map = NULL;
+		goto err_close;
+	}
+
+	hdr = replay->map;
+	if ((hdr->magic != REPLAY_MAGIC) ||
+	    (hdr->version != REPLAY_VERSION) ||
+	    (hdr->rec_size != sizeof(struct replay_rec)) ||
+	    (hdr->count == 0) ||
+	    (hdr->count > (sb.st_size - sizeof(*hdr)) /
+			  sizeof(struct replay_rec)))
+		goto err_format;
+
+	replay->recs = (const struct replay_rec *)(hdr + 1);
+	replay->count = hdr->count;
+	replay->start = UINT64_MAX;
+
+	for (i = 0; i < replay->count; i++) {
+		rec = &replay->recs[i];
+		if ((rec->length == 0) ||
+		    (i && (rec->time < replay->recs[i - 1].time))) {
+			fprintf(stderr,"%s: record %llu is not valid\n", path,
+				(unsigned long long)i);
+			goto err_unmap;
+		}
+		if (rec->offset < replay->start)
+			replay->start = rec->offset;
+		if (rec->offset + rec->length > replay->end)
+			replay->end = rec->offset + rec->length;
+		replay->bytes += rec->length;
+	}
+	replay->duration = replay->recs[replay->count - 1].time;
+
+	return 0;
+
+err_format:
+	fprintf(stderr,"%s is not a replay file\n", path);
+err_unmap:
+	if (replay->map)
+		munmap(replay->map, replay->map_size);
+err_close:
+	close(replay->fd);
+	return -1;
+} /* replay_open */
+
+
+void replay_close(struct replay *replay)
+{
+	munmap(replay->map, replay->map_size);
+	close(replay->fd);
+} /* replay_close */
@@ -0,0 +1,52 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Discard trace to replay. The file is a header followed by a compact
+ * array of records sorted by time, made from blkparse output by
+ * blk2replay. It is mapped to memory read only and walked in place,
+ * so replaying an operation costs no parsing and no system call.
+ */
+
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define REPLAY_MAGIC	0x59414c5045524453ULL	/* "SDREPLAY" */
+#define REPLAY_VERSION	1
+
+struct replay_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t rec_size;	/* sizeof(struct replay_rec) */
+	uint64_t count;		/* number of records */
+};
+
+struct replay_rec {
+	uint64_t time;		/* ns since the first record */
+	uint64_t offset;	/* bytes */
+	uint64_t length;	/* bytes */
+};
+
+struct replay {
+	int fd;
+	void *map;
+	size_t map_size;
+	const struct replay_rec *recs;
+	uint64_t count;
+	uint64_t start;		/* lowest offset discarded */
+	uint64_t end;		/* highest end of a discard */
+	uint64_t bytes;		/* all bytes discarded */
+	uint64_t duration;	/* ns of the last record */
+};
+
+extern int replay_open(struct replay *replay, const char *path);
+extern void replay_close(struct replay *replay);
+
+#endif /* _REPLAY_H */
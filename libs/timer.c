@@ -0,0 +1,143 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "timer.h"
+
+#define CALIBRATION_NS	100000000ULL	/* 100ms */
+#define OVERHEAD_LOOPS	1000
+
+int timer_type = TIMER_RAW;
+double timer_ns_per_tick = 1.0;
+uint64_t timer_overhead;
+
+static uint64_t raw_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef HAVE_TSC
+/**
+ * The TSC is only usable as a clock when it ticks at constant
+ * rate and does not stop in deep C-states
+ */
+static int tsc_is_invariant(void)
+{
+	char line[4096];
+	FILE *f;
+	int ret = 0;
+
+	if ((f = fopen("/proc/cpuinfo", "r")) == NULL)
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "flags", 5))
+			continue;
+		ret = strstr(line, " constant_tsc") &&
+		      strstr(line, " nonstop_tsc");
+		break;
+	}
+
+	fclose(f);
+	return ret;
+}
+
+/**
+ * Count TSC ticks during CALIBRATION_NS of CLOCK_MONOTONIC_RAW
+ */
+static void tsc_calibrate(void)
+{
+	uint64_t ns_start, ns_stop, tsc_start, tsc_stop;
+	unsigned int aux;
+
+	ns_start = raw_ns();
+	tsc_start = __rdtscp(&aux);
+	do {
+		ns_stop = raw_ns();
+	} while (ns_stop - ns_start < CALIBRATION_NS);
+	tsc_stop = __rdtscp(&aux);
+
+	timer_ns_per_tick = (double)(ns_stop - ns_start) /
+			    (double)(tsc_stop - tsc_start);
+}
+#endif
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Median cost of two back to back readings. This is what every
+ * measured interval contains on top of the measured operation
+ */
+static void measure_overhead(void)
+{
+	uint64_t samples[OVERHEAD_LOOPS], start;
+	int i;
+
+	timer_overhead = 0;
+	for (i = 0; i < OVERHEAD_LOOPS; i++) {
+		start = timer_now();
+		samples[i] = timer_ns(timer_now() - start);
+	}
+
+	qsort(samples, OVERHEAD_LOOPS, sizeof(uint64_t), cmp_u64);
+	timer_overhead = samples[OVERHEAD_LOOPS / 2];
+}
+
+/**
+ * Select the time source, calibrate it and measure overhead
+ * of reading it. Returns -1 if the source is not usable.
+ */
+int timer_init(int type)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts) == -1) {
+		perror("clock_gettime");
+		return -1;
+	}
+
+	timer_type = TIMER_RAW;
+	timer_ns_per_tick = 1.0;
+
+	if (type == TIMER_TSC) {
+#ifdef HAVE_TSC
+		if (!tsc_is_invariant())
+			fprintf(stderr, "Warning: TSC is not invariant, "
+				"timing may be wrong\n");
+		tsc_calibrate();
+		timer_type = TIMER_TSC;
+#else
+		fprintf(stderr, "TSC timer is not supported on this "
+			"architecture\n");
+		return -1;
+#endif
+	}
+
+	measure_overhead();
+	return 0;
+} /* timer_init */
+
+
+const char *timer_name(void)
+{
+	if (timer_type == TIMER_TSC)
+		return "tsc";
+	return "clock_monotonic_raw";
+} /* timer_name */
@@ -0,0 +1,76 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Cheap monotonic timer for the discard hot path. Time is read either
+ * from CLOCK_MONOTONIC_RAW, which is not affected by NTP adjustments,
+ * or directly from the TSC calibrated against it. timer_now() returns
+ * ticks of the selected source, use timer_ns() to convert the
+ * difference of two readings to nanoseconds and timer_ticks() to
+ * convert nanoseconds back to ticks.
+ */
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define TIMER_RAW	0	/* clock_gettime(CLOCK_MONOTONIC_RAW) */
+#define TIMER_TSC	1	/* calibrated time stamp counter */
+
+extern int timer_type;
+extern double timer_ns_per_tick;
+extern uint64_t timer_overhead;		/* cost of one reading in ns */
+
+static inline uint64_t timer_now(void)
+{
+	struct timespec ts;
+#ifdef HAVE_TSC
+	unsigned int aux;
+
+	if (timer_type == TIMER_TSC)
+		return __rdtscp(&aux);
+#endif
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t timer_ns(uint64_t ticks)
+{
+	if (timer_type == TIMER_TSC)
+		return (uint64_t)(ticks * timer_ns_per_tick);
+	return ticks;
+}
+
+static inline uint64_t timer_ticks(uint64_t ns)
+{
+	if (timer_type == TIMER_TSC)
+		return (uint64_t)(ns / timer_ns_per_tick);
+	return ns;
+}
+
+/**
+ * Duration of the timed operation in nanoseconds with the
+ * cost of reading the timer taken out
+ */
+static inline uint64_t timer_sample(uint64_t start, uint64_t stop)
+{
+	uint64_t ns = timer_ns(stop - start);
+
+	return (ns > timer_overhead) ? ns - timer_overhead : 0;
+}
+
+extern int timer_init(int type);
+extern const char *timer_name(void);
+
+#endif /* _TIMER_H */
@@ -0,0 +1,135 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+static size_t trace_size(uint64_t nrecs)
+{
+	return sizeof(struct trace_header) + nrecs * sizeof(struct trace_rec);
+}
+
+/**
+ * Create the log file with the header and no records
+ */
+int trace_open(struct trace *trace, const char *path)
+{
+	memset(trace, 0, sizeof(*trace));
+
+	if ((trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+		perror("Opening trace file");
+		return -1;
+	}
+
+	return trace_reserve(trace, 0);
+} /* trace_open */
+
+
+/**
+ * Make sure there is space for nrecs more records. The file is
+ * preallocated, so storing records into the mapping does not
+ * have to allocate blocks. Must not be called while workers
+ * are logging.
+ */
+int trace_reserve(struct trace *trace, uint64_t nrecs)
+{
+	uint64_t used, capacity;
+	size_t size;
+	void *map;
+	int err;
+
+	used = (trace->next < trace->capacity) ? trace->next : trace->capacity;
+	trace->next = used;
+	if (used + nrecs <= trace->capacity && trace->map)
+		return 0;
+
+	/* grow at least twice to keep the number of remaps low */
+	capacity = trace->capacity * 2;
+	if (capacity < used + nrecs)
+		capacity = used + nrecs;
+	size = trace_size(capacity);
+
+	if ((err = posix_fallocate(trace->fd, 0, size)) != 0) {
+		/* not every file system can do it, sparse file is fine */
+		if ((err != EOPNOTSUPP) && (err != EINVAL)) {
+			errno = err;
+			perror("Allocating trace file");
+			return -1;
+		}
+		if (ftruncate(trace->fd, size) == -1) {
+			perror("Resizing trace file");
+			return -1;
+		}
+	}
+
+	if (trace->map)
+		map = mremap(trace->map, trace->map_size, size, MREMAP_MAYMOVE);
+	else
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   trace->fd, 0);
+	if (map == MAP_FAILED) {
+		perror("Mapping trace file");
+		return -1;
+	}
+
+	trace->map = map;
+	trace->map_size = size;
+	trace->hdr = map;
+	trace->recs = (struct trace_rec *)(trace->hdr + 1);
+	trace->capacity = capacity;
+
+	trace->hdr->magic = TRACE_MAGIC;
+	trace->hdr->version = TRACE_VERSION;
+	trace->hdr->rec_size = sizeof(struct trace_rec);
+
+	return 0;
+} /* trace_reserve */
+
+
+/**
+ * Store the number of records, cut off unused space and close
+ * the log. Returns -1 if the log could not be written.
+ */
+int trace_close(struct trace *trace)
+{
+	uint64_t count;
+	int ret = 0;
+
+	count = (trace->next < trace->capacity) ? trace->next : trace->capacity;
+
+	if (trace->map) {
+		trace->hdr->count = count;
+		trace->hdr->dropped = trace->dropped;
+		if (msync(trace->map, trace->map_size, MS_SYNC) == -1) {
+			perror("Writing trace file");
+			ret = -1;
+		}
+		munmap(trace->map, trace->map_size);
+	}
+
+	if (ftruncate(trace->fd, trace_size(count)) == -1) {
+		perror("Resizing trace file");
+		ret = -1;
+	}
+
+	if (close(trace->fd) == -1) {
+		perror("Closing trace file");
+		ret = -1;
+	}
+
+	return ret;
+} /* trace_close */
@@ -0,0 +1,82 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Binary log of individual discard operations. The log file is
+ * preallocated and mapped to memory, workers claim record slots with
+ * an atomic counter and fill them in place, so logging an operation
+ * costs no system call. Space for the records is reserved between test
+ * steps, records which would not fit are only counted as dropped.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_MAGIC	0x4543415254445354ULL	/* "TSDTRACE" */
+#define TRACE_VERSION	1
+
+struct trace_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t rec_size;	/* sizeof(struct trace_rec) */
+	uint64_t count;		/* number of valid records */
+	uint64_t dropped;	/* records which did not fit */
+};
+
+struct trace_rec {
+	uint64_t time;		/* ns since the start of the run */
+	uint64_t offset;	/* bytes */
+	uint64_t length;	/* bytes */
+	uint64_t latency;	/* ns */
+	uint32_t worker;
+	uint32_t pad;
+};
+
+struct trace {
+	int fd;
+	void *map;
+	size_t map_size;
+	struct trace_header *hdr;
+	struct trace_rec *recs;
+	uint64_t capacity;	/* records which fit into the mapping */
+	uint64_t next;		/* next free slot */
+	uint64_t dropped;
+};
+
+/**
+ * Log one operation, safe to call from several threads
+ */
+static inline void trace_add(struct trace *trace, uint64_t time,
+			     uint64_t offset, uint64_t length,
+			     uint64_t latency, uint32_t worker)
+{
+	struct trace_rec *rec;
+	uint64_t idx;
+
+	idx = __atomic_fetch_add(&trace->next, 1, __ATOMIC_RELAXED);
+	if (idx >= trace->capacity) {
+		__atomic_fetch_add(&trace->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	rec = &trace->recs[idx];
+	rec->time = time;
+	rec->offset = offset;
+	rec->length = length;
+	rec->latency = latency;
+	rec->worker = worker;
+	rec->pad = 0;
+}
+
+extern int trace_open(struct trace *trace, const char *path);
+extern int trace_reserve(struct trace *trace, uint64_t nrecs);
+extern int trace_close(struct trace *trace);
+
+#endif /* _TRACE_H */
@@ -0,0 +1,1054 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rbtree.h"
+#include "arena.h"
+#include "tracker.h"
+
+/**
+ * Get random block number on the disk
+ */
+static unsigned long long get_random_block(struct tracker *t,
+					   unsigned long long max)
+{
+	return prng_bounded(&t->rng, max);
+} /* get_random_block */
+
+
+/**
+ * Save the discarded extents in ascending order, with their
+ * number first. Used by the trackers which iterate that way.
+ */
+static int save_extents(struct tracker *t, FILE *f)
+{
+	struct tracker_iter it;
+	struct extent ext;
+	uint64_t n = 0;
+	int ret;
+
+	tracker_iter_init(t, &it);
+	while ((ret = tracker_iter_next(t, &it, &ext)) == 1)
+		n++;
+	if ((ret == -1) || (fwrite(&n, sizeof(n), 1, f) != 1))
+		return -1;
+
+	tracker_iter_init(t, &it);
+	while ((ret = tracker_iter_next(t, &it, &ext)) == 1)
+		if (fwrite(&ext, sizeof(ext), 1, f) != 1)
+			return -1;
+
+	return ret;
+} /* save_extents */
+
+
+/**
+ * Load the extents saved by save_extents() and pass every one of
+ * them to mark, checking they are ascending and fit in the tracker
+ */
+static int load_extents(struct tracker *t, FILE *f,
+			int (*mark)(struct tracker *t, struct extent *ext))
+{
+	unsigned long long end = 0;
+	struct extent ext;
+	uint64_t i, n;
+
+	if (fread(&n, sizeof(n), 1, f) != 1)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (fread(&ext, sizeof(ext), 1, f) != 1)
+			return -1;
+		if ((ext.count == 0) || (ext.start < end) ||
+		    (ext.start + ext.count > t->nblocks)) {
+			fprintf(stderr, "Saved extent %llu(%llu) is not "
+				"valid\n", ext.start, ext.count);
+			return -1;
+		}
+		if (mark(t, &ext) == -1)
+			return -1;
+		end = ext.start + ext.count;
+	}
+
+	return 0;
+} /* load_extents */
+
+
+/*
+ * rbtree tracker
+ */
+
+/**
+ * Structure for creating tree of discarded
+ * records
+ */
+struct discarded_entry {
+	unsigned long long start;
+	unsigned long long count;
+	struct rb_node node;
+};
+
+#define ENTRIES_PER_CHUNK	4096
+
+/*
+ * Entries are allocated from the arena, so merging extents recycles
+ * them through its free list and the whole tree is freed at once
+ */
+struct rbtree_tracker {
+	struct rb_root root;
+	struct arena entries;
+};
+
+static void free_entry(struct rbtree_tracker *rt,
+		       struct discarded_entry **entry)
+{
+	arena_free(&rt->entries, *entry);
+	*entry = NULL;
+}
+
+/**
+ * Free the tree
+ */
+static void free_tree(struct rbtree_tracker *rt)
+{
+	rt->root = RB_ROOT;
+	arena_reset(&rt->entries);
+} /* free_tree */
+
+
+/**
+ * Allocate new item and initialize it with block 
+ * values
+ */
+static struct discarded_entry *alloc_and_init(struct rbtree_tracker *rt,
+					      unsigned long long block)
+{
+	struct discarded_entry *new = NULL;
+
+	if ((new = arena_alloc(&rt->entries)) == NULL) {
+		return NULL;
+	}	
+
+	new->start = block;
+	new->count = 1;
+
+	return new;
+} /* alloc_and_init */
+
+
+/**
+ * Claim the block, or the first free one after it:
+ * 1. Search for the matching extent
+ * 2. If not found create new one, otherwise extend existing
+ * 3. See if we can merge to the right
+ */
+static long long rbtree_claim(struct tracker *t, unsigned long long block)
+{
+	struct rbtree_tracker *rt = t->priv;
+	struct rb_node *parent = NULL, **n = &rt->root.rb_node;
+	struct discarded_entry *entry, *new_entry;
+	struct rb_node *new_node, *node;
+	int wrapped = 0;
+
+	while (*n) {
+		parent = *n;
+		entry = rb_entry(parent, struct discarded_entry, node);
+
+		if (block < entry->start) {
+			n = &(*n)->rb_left;
+		} else if (block > (entry->start + entry->count)) {
+			n = &(*n)->rb_right;
+		} else {
+			unsigned long long end = entry->start + entry->count;
+
+			if (end >= t->nblocks) {
+				if (wrapped++) {
+					fprintf(stderr, "No free block left "
+						"on the device\n");
+					return -1;
+				}
+				block = 0;
+				parent = NULL;
+				n = &rt->root.rb_node;
+				continue;
+			}
+
+			entry->count += 1;
+			block = end;
+			new_entry = entry;
+			new_node = &new_entry->node;
+			goto skip_insert;
+		}
+	}
+
+	if ((new_entry = alloc_and_init(rt, block)) == NULL)
+		return -1;
+	new_node = &new_entry->node;
+	rb_link_node(new_node, parent, n);
+	rb_insert_color(new_node, &rt->root);
+
+skip_insert:
+	/* See if we can merge to the right */
+	node = rb_next(new_node);
+	if (node) {
+		entry = rb_entry(node, struct discarded_entry, node);
+		if (entry->start == new_entry->start + new_entry->count) {
+			new_entry->count += entry->count;
+			rb_erase(node, &rt->root);
+			free_entry(rt, &entry);
+		}
+	}
+
+	return block;
+
+} /* rbtree_claim */
+
+
+/**
+ * Guess the next block: claim a random block, or the
+ * first free one after it
+ */
+static long long guess_next_block(struct tracker *t)
+{
+	return rbtree_claim(t, get_random_block(t, t->nblocks));
+} /* guess_next_block */
+
+
+static int rbtree_test(struct tracker *t, unsigned long long block)
+{
+	struct rbtree_tracker *rt = t->priv;
+	struct rb_node *n = rt->root.rb_node;
+	struct discarded_entry *entry;
+
+	while (n) {
+		entry = rb_entry(n, struct discarded_entry, node);
+
+		if (block < entry->start)
+			n = n->rb_left;
+		else if (block >= (entry->start + entry->count))
+			n = n->rb_right;
+		else
+			return 1;
+	}
+	return 0;
+}
+
+static int rbtree_init(struct tracker *t)
+{
+	struct rbtree_tracker *rt;
+
+	if ((rt = malloc(sizeof(*rt))) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	rt->root = RB_ROOT;
+	arena_init(&rt->entries, sizeof(struct discarded_entry),
+		   ENTRIES_PER_CHUNK);
+	t->priv = rt;
+
+	return 0;
+}
+
+static void rbtree_iter_init(struct tracker *t, struct tracker_iter *it)
+{
+	struct rbtree_tracker *rt = t->priv;
+
+	it->node = rb_first(&rt->root);
+	it->pos = 0;
+}
+
+static int rbtree_iter_next(struct tracker *t, struct tracker_iter *it,
+			    struct extent *ext)
+{
+	struct discarded_entry *entry;
+	struct rb_node *node = it->node;
+
+	if (node == NULL)
+		return 0;
+
+	entry = rb_entry(node, struct discarded_entry, node);
+
+	if (entry->count == 0) {
+		fprintf(stderr, "Programming error: empty extent at %llu\n",
+			entry->start);
+		return -1;
+	}
+
+	/* it->pos is the end of the previous extent */
+	if (it->pos && (it->pos >= entry->start)) {
+		fprintf(stderr, "Programming error tree is corrupted:\n"
+				" prev ->%llu\n"
+				" cur %llu->%llu(%llu)\n",
+				it->pos, entry->start,
+				entry->start + entry->count,
+				entry->count);
+		return -1;
+	}
+
+	ext->start = entry->start;
+	ext->count = entry->count;
+	it->pos = entry->start + entry->count;
+	it->node = rb_next(node);
+
+	return 1;
+}
+
+static int rbtree_reset(struct tracker *t)
+{
+	free_tree(t->priv);
+	return 0;
+}
+
+/**
+ * Insert the saved extent, it does not touch any other one
+ */
+static int rbtree_mark(struct tracker *t, struct extent *ext)
+{
+	struct rbtree_tracker *rt = t->priv;
+	struct rb_node *parent = NULL, **n = &rt->root.rb_node;
+	struct discarded_entry *entry;
+
+	while (*n) {
+		parent = *n;
+		entry = rb_entry(parent, struct discarded_entry, node);
+		if (ext->start < entry->start)
+			n = &(*n)->rb_left;
+		else
+			n = &(*n)->rb_right;
+	}
+
+	if ((entry = alloc_and_init(rt, ext->start)) == NULL)
+		return -1;
+	entry->count = ext->count;
+	rb_link_node(&entry->node, parent, n);
+	rb_insert_color(&entry->node, &rt->root);
+
+	return 0;
+}
+
+static int rbtree_load(struct tracker *t, FILE *f)
+{
+	return load_extents(t, f, rbtree_mark);
+}
+
+static size_t rbtree_memory(struct tracker *t)
+{
+	struct rbtree_tracker *rt = t->priv;
+
+	return rt->entries.peak * rt->entries.obj_size;
+}
+
+static void rbtree_destroy(struct tracker *t)
+{
+	struct rbtree_tracker *rt = t->priv;
+
+	arena_destroy(&rt->entries);
+	free(rt);
+}
+
+static const struct tracker_ops rbtree_ops = {
+	.name		= "rbtree",
+	.init		= rbtree_init,
+	.next_block	= guess_next_block,
+	.claim		= rbtree_claim,
+	.test		= rbtree_test,
+	.iter_init	= rbtree_iter_init,
+	.iter_next	= rbtree_iter_next,
+	.reset		= rbtree_reset,
+	.save		= save_extents,
+	.load		= rbtree_load,
+	.memory		= rbtree_memory,
+	.destroy	= rbtree_destroy,
+};
+
+
+/*
+ * bitmap tracker
+ *
+ * One bit per block. Blocks are grouped in pages of 64 words (4096
+ * blocks) and pages in groups of 64 pages, with the number of used
+ * blocks kept for every page and group. Free block is picked by
+ * trying random blocks first. When the device gets full the tries
+ * keep failing, so we pick a random rank among free blocks instead
+ * and find it by walking the summary counts. A Fenwick tree of the
+ * free blocks of the groups finds the group of the rank in
+ * O(log groups), then at most 64 pages and 64 words are walked.
+ * Marking a block updates the tree, so picking and marking a block
+ * costs O(log groups).
+ */
+
+#define WORD_BITS	64
+#define PAGE_WORDS	64
+#define PAGE_BITS	(WORD_BITS * PAGE_WORDS)
+#define GROUP_PAGES	64
+#define GROUP_BITS	(PAGE_BITS * GROUP_PAGES)
+#define RANDOM_TRIES	8
+
+struct bitmap_tracker {
+	uint64_t *words;
+	uint16_t *page_used;
+	uint32_t *group_used;
+	uint64_t *group_tree;	/* Fenwick tree of free blocks, from 1 */
+	unsigned long long tree_top;	/* highest power of two in it */
+	unsigned long long nwords;
+	unsigned long long npages;
+	unsigned long long ngroups;
+	unsigned long long used;
+};
+
+static void bitmap_free(struct bitmap_tracker *bt)
+{
+	free(bt->words);
+	free(bt->page_used);
+	free(bt->group_used);
+	free(bt->group_tree);
+	bt->words = NULL;
+	bt->page_used = NULL;
+	bt->group_used = NULL;
+	bt->group_tree = NULL;
+}
+
+/**
+ * Number of blocks covered by the unit of given size at the index,
+ * only the last one may be partial
+ */
+static inline unsigned long long unit_bits(struct tracker *t,
+					   unsigned long long index,
+					   unsigned long long bits)
+{
+	if ((index + 1) * bits > t->nblocks)
+		return t->nblocks - index * bits;
+	return bits;
+}
+
+/**
+ * Fill the Fenwick tree with the free blocks of every group in
+ * O(groups), every node passes its sum to the parent
+ */
+static void bitmap_build_tree(struct tracker *t)
+{
+	struct bitmap_tracker *bt = t->priv;
+	unsigned long long i, j;
+
+	for (i = 1; i <= bt->ngroups; i++)
+		bt->group_tree[i] = unit_bits(t, i - 1, GROUP_BITS) -
+				    bt->group_used[i - 1];
+
+	for (i = 1; i <= bt->ngroups; i++) {
+		j = i + (i & -i);
+		if (j <= bt->ngroups)
+			bt->group_tree[j] += bt->group_tree[i];
+	}
+
+	for (bt->tree_top = 1; bt->tree_top * 2 <= bt->ngroups;
+	     bt->tree_top *= 2)
+		;
+}
+
+static int bitmap_alloc(struct tracker *t)
+{
+	struct bitmap_tracker *bt = t->priv;
+
+	bt->nwords = (t->nblocks + WORD_BITS - 1) / WORD_BITS;
+	bt->npages = (t->nblocks + PAGE_BITS - 1) / PAGE_BITS;
+	bt->ngroups = (t->nblocks + GROUP_BITS - 1) / GROUP_BITS;
+	bt->used = 0;
+
+	/* keep whole pages so the reset can clear them at once */
+	bt->words = calloc(bt->npages * PAGE_WORDS, sizeof(uint64_t));
+	bt->page_used = calloc(bt->npages, sizeof(uint16_t));
+	bt->group_used = calloc(bt->ngroups, sizeof(uint32_t));
+	bt->group_tree = calloc(bt->ngroups + 1, sizeof(uint64_t));
+
+	if (!bt->words || !bt->page_used || !bt->group_used ||
+	    !bt->group_tree) {
+		perror("calloc");
+		bitmap_free(bt);
+		return -1;
+	}
+
+	bitmap_build_tree(t);
+	return 0;
+}
+
+static inline int bitmap_test(struct bitmap_tracker *bt,
+			      unsigned long long block)
+{
+	return (bt->words[block / WORD_BITS] >> (block % WORD_BITS)) & 1;
+}
+
+static inline void bitmap_set(struct bitmap_tracker *bt,
+			      unsigned long long block)
+{
+	unsigned long long i;
+
+	bt->words[block / WORD_BITS] |= 1ULL << (block % WORD_BITS);
+	bt->page_used[block / PAGE_BITS]++;
+	bt->group_used[block / GROUP_BITS]++;
+	bt->used++;
+
+	for (i = block / GROUP_BITS + 1; i <= bt->ngroups; i += i & -i)
+		bt->group_tree[i]--;
+}
+
+/**
+ * Find the rank-th (from zero) free block
+ */
+static unsigned long long bitmap_select_free(struct tracker *t,
+					     unsigned long long rank)
+{
+	struct bitmap_tracker *bt = t->priv;
+	unsigned long long g, p, w, free, step;
+	uint64_t word;
+
+	/* skip the groups whose free blocks add up to rank at most,
+	 * descending the tree, the rank is in the group after them */
+	for (g = 0, step = bt->tree_top; step; step /= 2) {
+		if ((g + step <= bt->ngroups) &&
+		    (bt->group_tree[g + step] <= rank)) {
+			g += step;
+			rank -= bt->group_tree[g];
+		}
+	}
+
+	for (p = g * GROUP_PAGES; p < bt->npages; p++) {
+		free = unit_bits(t, p, PAGE_BITS) - bt->page_used[p];
+		if (rank < free)
+			break;
+		rank -= free;
+	}
+
+	for (w = p * PAGE_WORDS; w < bt->nwords; w++) {
+		free = unit_bits(t, w, WORD_BITS) -
+		       __builtin_popcountll(bt->words[w]);
+		if (rank < free)
+			break;
+		rank -= free;
+	}
+
+	/*
+	 * bits past the end of the device look free in the inverted
+	 * word, but the rank is below the free blocks within the
+	 * device, so the loop never gets to them
+	 */
+	word = ~bt->words[w];
+	while (rank--)
+		word &= word - 1;
+
+	return w * WORD_BITS + __builtin_ctzll(word);
+}
+
+static long long bitmap_next_block(struct tracker *t)
+{
+	struct bitmap_tracker *bt = t->priv;
+	unsigned long long block;
+	int i;
+
+	if (bt->used >= t->nblocks) {
+		fprintf(stderr, "No free block left on the device\n");
+		return -1;
+	}
+
+	for (i = 0; i < RANDOM_TRIES; i++) {
+		block = get_random_block(t, t->nblocks);
+		if (!bitmap_test(bt, block))
+			goto found;
+	}
+
+	block = bitmap_select_free(t,
+			get_random_block(t, t->nblocks - bt->used));
+found:
+	bitmap_set(bt, block);
+	return block;
+}
+
+static unsigned long long bitmap_find(struct tracker *t,
+				      unsigned long long pos, int set);
+
+static long long bitmap_claim(struct tracker *t, unsigned long long block)
+{
+	struct bitmap_tracker *bt = t->priv;
+
+	if (bt->used >= t->nblocks) {
+		fprintf(stderr, "No free block left on the device\n");
+		return -1;
+	}
+
+	if (bitmap_test(bt, block)) {
+		block = bitmap_find(t, block, 0);
+		if (block >= t->nblocks)
+			block = bitmap_find(t, 0, 0);
+	}
+	bitmap_set(bt, block);
+	return block;
+}
+
+static int bitmap_is_set(struct tracker *t, unsigned long long block)
+{
+	return bitmap_test(t->priv, block) != 0;
+}
+
+static int bitmap_init(struct tracker *t)
+{
+	struct bitmap_tracker *bt;
+
+	if ((bt = calloc(1, sizeof(*bt))) == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	t->priv = bt;
+
+	if (bitmap_alloc(t) == -1) {
+		free(bt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bitmap_iter_init(struct tracker *t, struct tracker_iter *it)
+{
+	it->node = NULL;
+	it->pos = 0;
+}
+
+/**
+ * Find first set (or clear) bit at or after pos, skipping pages
+ * and groups which are completely free when looking for set bits
+ */
+static unsigned long long bitmap_find(struct tracker *t,
+				      unsigned long long pos, int set)
+{
+	struct bitmap_tracker *bt = t->priv;
+	unsigned long long w;
+	uint64_t word;
+
+	while (pos < t->nblocks) {
+		if (set && !(pos % GROUP_BITS) &&
+		    !bt->group_used[pos / GROUP_BITS]) {
+			pos += GROUP_BITS;
+			continue;
+		}
+		if (set && !(pos % PAGE_BITS) &&
+		    !bt->page_used[pos / PAGE_BITS]) {
+			pos += PAGE_BITS;
+			continue;
+		}
+
+		w = pos / WORD_BITS;
+		word = set ? bt->words[w] : ~bt->words[w];
+		word &= ~0ULL << (pos % WORD_BITS);
+		if (word) {
+			pos = w * WORD_BITS + __builtin_ctzll(word);
+			break;
+		}
+		pos = (w + 1) * WORD_BITS;
+	}
+
+	return (pos > t->nblocks) ? t->nblocks : pos;
+}
+
+static int bitmap_iter_next(struct tracker *t, struct tracker_iter *it,
+			    struct extent *ext)
+{
+	unsigned long long start, end;
+
+	start = bitmap_find(t, it->pos, 1);
+	if (start >= t->nblocks)
+		return 0;
+
+	end = bitmap_find(t, start, 0);
+
+	ext->start = start;
+	ext->count = end - start;
+	it->pos = end;
+
+	return 1;
+}
+
+/**
+ * Clear only pages which have some block set
+ */
+static int bitmap_reset(struct tracker *t)
+{
+	struct bitmap_tracker *bt = t->priv;
+	unsigned long long p;
+
+	if (bt->words && (bt->npages ==
+	    (t->nblocks + PAGE_BITS - 1) / PAGE_BITS)) {
+		for (p = 0; p < bt->npages; p++) {
+			if (!bt->page_used[p])
+				continue;
+			memset(&bt->words[p * PAGE_WORDS], 0,
+			       PAGE_WORDS * sizeof(uint64_t));
+			bt->page_used[p] = 0;
+		}
+		memset(bt->group_used, 0, bt->ngroups * sizeof(uint32_t));
+		bt->nwords = (t->nblocks + WORD_BITS - 1) / WORD_BITS;
+		bt->used = 0;
+		bitmap_build_tree(t);
+		return 0;
+	}
+
+	/* the number of blocks changed too much, start over */
+	bitmap_free(bt);
+	return bitmap_alloc(t);
+}
+
+static int bitmap_mark(struct tracker *t, struct extent *ext)
+{
+	unsigned long long block;
+
+	for (block = ext->start; block < ext->start + ext->count; block++)
+		bitmap_set(t->priv, block);
+
+	return 0;
+}
+
+static int bitmap_load(struct tracker *t, FILE *f)
+{
+	return load_extents(t, f, bitmap_mark);
+}
+
+static size_t bitmap_memory(struct tracker *t)
+{
+	struct bitmap_tracker *bt = t->priv;
+
+	return bt->npages * (PAGE_WORDS * sizeof(uint64_t) +
+			     sizeof(uint16_t)) +
+	       bt->ngroups * sizeof(uint32_t) +
+	       (bt->ngroups + 1) * sizeof(uint64_t);
+}
+
+static void bitmap_destroy(struct tracker *t)
+{
+	bitmap_free(t->priv);
+	free(t->priv);
+}
+
+static const struct tracker_ops bitmap_ops = {
+	.name		= "bitmap",
+	.init		= bitmap_init,
+	.next_block	= bitmap_next_block,
+	.claim		= bitmap_claim,
+	.test		= bitmap_is_set,
+	.iter_init	= bitmap_iter_init,
+	.iter_next	= bitmap_iter_next,
+	.reset		= bitmap_reset,
+	.save		= save_extents,
+	.load		= bitmap_load,
+	.memory		= bitmap_memory,
+	.destroy	= bitmap_destroy,
+};
+
+
+/*
+ * perm tracker
+ *
+ * Keyed bijection of [0, nblocks) built from a balanced Feistel network
+ * over the smallest even number of bits covering nblocks. Values which
+ * fall out of the range are fed to the network again (cycle walking),
+ * which keeps it a bijection. The n-th picked block is perm(n), so every
+ * block is picked exactly once in random order with O(1) memory. Blocks
+ * come out of the iterator in the order they were picked.
+ */
+
+#define FEISTEL_ROUNDS	4
+
+struct perm_tracker {
+	uint64_t keys[FEISTEL_ROUNDS];
+	unsigned half_bits;
+	uint64_t half_mask;
+	unsigned long long next;	/* number of blocks picked so far */
+};
+
+static inline uint64_t feistel_round(uint64_t x, uint64_t key)
+{
+	x ^= key;
+	x = (x ^ (x >> 31)) * 0x7fb5d329728ea185ULL;
+	x = (x ^ (x >> 27)) * 0x81dadef4bc2dd44dULL;
+	return x ^ (x >> 33);
+}
+
+static uint64_t feistel(struct perm_tracker *pt, uint64_t x)
+{
+	uint64_t left, right, tmp;
+	int i;
+
+	left = x >> pt->half_bits;
+	right = x & pt->half_mask;
+
+	for (i = 0; i < FEISTEL_ROUNDS; i++) {
+		tmp = right;
+		right = left ^ (feistel_round(right, pt->keys[i]) &
+				pt->half_mask);
+		left = tmp;
+	}
+
+	return (left << pt->half_bits) | right;
+}
+
+static unsigned long long perm_block(struct tracker *t,
+				     unsigned long long index)
+{
+	struct perm_tracker *pt = t->priv;
+	uint64_t x = index;
+
+	do {
+		x = feistel(pt, x);
+	} while (x >= t->nblocks);
+
+	return x;
+}
+
+/**
+ * Pick new keys and size the network for nblocks
+ */
+static int perm_reset(struct tracker *t)
+{
+	struct perm_tracker *pt = t->priv;
+	unsigned bits = 2;
+	int i;
+
+	while ((bits < 64) && ((1ULL << bits) < t->nblocks))
+		bits += 2;
+
+	pt->half_bits = bits / 2;
+	pt->half_mask = (1ULL << pt->half_bits) - 1;
+	pt->next = 0;
+	for (i = 0; i < FEISTEL_ROUNDS; i++)
+		pt->keys[i] = prng_next(&t->rng);
+
+	return 0;
+}
+
+static int perm_init(struct tracker *t)
+{
+	if ((t->priv = malloc(sizeof(struct perm_tracker))) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	return perm_reset(t);
+}
+
+static long long perm_next_block(struct tracker *t)
+{
+	struct perm_tracker *pt = t->priv;
+
+	if (pt->next >= t->nblocks) {
+		fprintf(stderr, "No free block left on the device\n");
+		return -1;
+	}
+
+	return perm_block(t, pt->next++);
+}
+
+static void perm_iter_init(struct tracker *t, struct tracker_iter *it)
+{
+	it->node = NULL;
+	it->pos = 0;
+}
+
+static int perm_iter_next(struct tracker *t, struct tracker_iter *it,
+			  struct extent *ext)
+{
+	struct perm_tracker *pt = t->priv;
+
+	if (it->pos >= pt->next)
+		return 0;
+
+	ext->start = perm_block(t, it->pos++);
+	ext->count = 1;
+
+	return 1;
+}
+
+/**
+ * The permutation is given by the keys, the discarded blocks by the
+ * number of them picked so far
+ */
+static int perm_save(struct tracker *t, FILE *f)
+{
+	return (fwrite(t->priv, sizeof(struct perm_tracker), 1, f) == 1) ?
+	       0 : -1;
+}
+
+static int perm_load(struct tracker *t, FILE *f)
+{
+	struct perm_tracker *pt = t->priv;
+
+	if (fread(pt, sizeof(*pt), 1, f) != 1)
+		return -1;
+	if (pt->next > t->nblocks) {
+		fprintf(stderr, "Saved permutation is not valid\n");
+		return -1;
+	}
+	return 0;
+}
+
+static size_t perm_memory(struct tracker *t)
+{
+	return sizeof(struct perm_tracker);
+}
+
+static void perm_destroy(struct tracker *t)
+{
+	free(t->priv);
+}
+
+static const struct tracker_ops perm_ops = {
+	.name		= "perm",
+	.init		= perm_init,
+	.next_block	= perm_next_block,
+	.iter_init	= perm_iter_init,
+	.iter_next	= perm_iter_next,
+	.reset		= perm_reset,
+	.save		= perm_save,
+	.load		= perm_load,
+	.memory		= perm_memory,
+	.destroy	= perm_destroy,
+};
+
+
+static const struct tracker_ops *trackers[] = {
+	&rbtree_ops,
+	&bitmap_ops,
+	&perm_ops,
+	NULL,
+};
+
+/**
+ * Create tracker of given name for the device with nblocks blocks,
+ * blocks are picked from the random sequence given by the seed.
+ * Returns NULL if there is no such tracker or on error.
+ */
+struct tracker *tracker_create(const char *name, unsigned long long nblocks,
+			       uint64_t seed)
+{
+	const struct tracker_ops **ops;
+	struct tracker *t;
+
+	for (ops = trackers; *ops; ops++)
+		if (strcmp((*ops)->name, name) == 0)
+			break;
+
+	if (*ops == NULL) {
+		fprintf(stderr, "Unknown tracker %s\n", name);
+		return NULL;
+	}
+
+	if ((t = malloc(sizeof(*t))) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+
+	t->ops = *ops;
+	t->nblocks = nblocks;
+	t->priv = NULL;
+	prng_seed(&t->rng, seed);
+	pthread_mutex_init(&t->lock, NULL);
+
+	if (t->ops->init(t) == -1) {
+		free(t);
+		return NULL;
+	}
+
+	return t;
+} /* tracker_create */
+
+
+/**
+ * Forget all discarded blocks, the device has nblocks
+ * blocks from now on
+ */
+int tracker_reset(struct tracker *t, unsigned long long nblocks)
+{
+	t->nblocks = nblocks;
+	return t->ops->reset(t);
+} /* tracker_reset */
+
+
+void tracker_destroy(struct tracker *t)
+{
+	if (t == NULL)
+		return;
+
+	t->ops->destroy(t);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+} /* tracker_destroy */
+
+
+/**
+ * Header of the saved tracker, the state of the tracker follows
+ */
+struct tracker_image {
+	char name[16];
+	uint64_t nblocks;
+	struct prng rng;
+};
+
+/**
+ * Write the state of the tracker into the checkpoint file, so
+ * tracker_load() can restore it. Returns -1 on error.
+ */
+int tracker_save(struct tracker *t, FILE *f)
+{
+	struct tracker_image img;
+
+	memset(&img, 0, sizeof(img));
+	strncpy(img.name, t->ops->name, sizeof(img.name) - 1);
+	img.nblocks = t->nblocks;
+	img.rng = t->rng;
+
+	if ((fwrite(&img, sizeof(img), 1, f) != 1) ||
+	    (t->ops->save(t, f) == -1)) {
+		fprintf(stderr, "Saving tracker %s failed\n", t->ops->name);
+		return -1;
+	}
+
+	return 0;
+} /* tracker_save */
+
+
+/**
+ * Restore the state saved by tracker_save() into the tracker of
+ * the same kind, forgetting what it had. Returns -1 on error.
+ */
+int tracker_load(struct tracker *t, FILE *f)
+{
+	struct tracker_image img;
+
+	if (fread(&img, sizeof(img), 1, f) != 1)
+		goto err;
+
+	img.name[sizeof(img.name) - 1] = '\0';
+	if (strcmp(img.name, t->ops->name) != 0) {
+		fprintf(stderr, "Saved tracker is %s, not %s\n", img.name,
+			t->ops->name);
+		return -1;
+	}
+
+	if (tracker_reset(t, img.nblocks) == -1)
+		return -1;
+	t->rng = img.rng;
+
+	if (t->ops->load(t, f) == -1)
+		goto err;
+
+	return 0;
+err:
+	fprintf(stderr, "Loading tracker %s failed\n", t->ops->name);
+	return -1;
+} /* tracker_load */
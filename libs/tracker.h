@@ -0,0 +1,138 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Trackers of discarded blocks for the random IO mode. A tracker picks
+ * random blocks which were not discarded yet and remembers them, so
+ * they can be written again before the next step. All of them are used
+ * through the same interface, the implementation is chosen by name:
+ *
+ *  rbtree - tree of discarded extents
+ *  bitmap - bit per block with per page and per group summary counts
+ *  perm   - keyed random permutation of all blocks, no memory at all
+ *
+ * The state of every tracker can be saved into a checkpoint and loaded
+ * into a new tracker of the same kind.
+ */
+
+#ifndef _TRACKER_H
+#define _TRACKER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "prng.h"
+
+/**
+ * Extent of discarded blocks
+ */
+struct extent {
+	unsigned long long start;
+	unsigned long long count;
+};
+
+/**
+ * Position in the tracker when walking discarded extents
+ */
+struct tracker_iter {
+	void *node;
+	unsigned long long pos;
+};
+
+struct tracker;
+
+struct tracker_ops {
+	const char *name;
+	int (*init)(struct tracker *t);
+	long long (*next_block)(struct tracker *t);
+	/* NULL if the tracker can not discard the chosen blocks */
+	long long (*claim)(struct tracker *t, unsigned long long block);
+	int (*test)(struct tracker *t, unsigned long long block);
+	void (*iter_init)(struct tracker *t, struct tracker_iter *it);
+	int (*iter_next)(struct tracker *t, struct tracker_iter *it,
+			 struct extent *ext);
+	int (*reset)(struct tracker *t);
+	/* state of the discarded blocks for checkpoints */
+	int (*save)(struct tracker *t, FILE *f);
+	int (*load)(struct tracker *t, FILE *f);
+	size_t (*memory)(struct tracker *t);
+	void (*destroy)(struct tracker *t);
+};
+
+struct tracker {
+	const struct tracker_ops *ops;
+	unsigned long long nblocks;	/* number of blocks on the device */
+	pthread_mutex_t lock;		/* serializes concurrent workers */
+	struct prng rng;
+	void *priv;
+};
+
+extern struct tracker *tracker_create(const char *name,
+				      unsigned long long nblocks,
+				      uint64_t seed);
+extern int tracker_reset(struct tracker *t, unsigned long long nblocks);
+extern void tracker_destroy(struct tracker *t);
+extern int tracker_save(struct tracker *t, FILE *f);
+extern int tracker_load(struct tracker *t, FILE *f);
+
+/**
+ * Peak memory used by the tracker in bytes
+ */
+static inline size_t tracker_memory(struct tracker *t)
+{
+	return t->ops->memory(t);
+}
+
+/**
+ * Pick a block which was not discarded yet and remember it.
+ * Returns -1 on error.
+ */
+static inline long long tracker_next(struct tracker *t)
+{
+	return t->ops->next_block(t);
+}
+
+/**
+ * Remember the block, or the first free block after it when it was
+ * discarded already (wrapping around). Returns the block remembered
+ * or -1 when there is no free block left.
+ */
+static inline long long tracker_claim(struct tracker *t,
+				      unsigned long long block)
+{
+	return t->ops->claim(t, block);
+}
+
+/**
+ * Was the block discarded already ?
+ */
+static inline int tracker_test(struct tracker *t, unsigned long long block)
+{
+	return t->ops->test(t, block);
+}
+
+static inline void tracker_iter_init(struct tracker *t,
+				     struct tracker_iter *it)
+{
+	t->ops->iter_init(t, it);
+}
+
+/**
+ * Get next extent of discarded blocks. rbtree and bitmap return
+ * them in ascending order, perm in the order they were picked.
+ * Returns 1 if there is one, 0 at the end and -1 when the
+ * tracker is found corrupted.
+ */
+static inline int tracker_iter_next(struct tracker *t,
+				    struct tracker_iter *it,
+				    struct extent *ext)
+{
+	return t->ops->iter_next(t, it, ext);
+}
+
+#endif /* _TRACKER_H */
@@ -0,0 +1,182 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "uring.h"
+
+#define smp_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+/**
+ * Set up the ring with at least entries slots and map its
+ * queues. Returns 0 on success, -1 with errno set otherwise.
+ */
+int uring_init(struct uring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	int err;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+
+	if ((ring->fd = sys_io_uring_setup(entries, &p)) == -1)
+		return -1;
+
+	ring->entries = p.sq_entries;
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes +
+			     p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto err_close;
+
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_CQ_RING);
+	if (ring->cq_ring == MAP_FAILED)
+		goto err_sq;
+
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto err_cq;
+
+	ring->sq_head = ring->sq_ring + p.sq_off.head;
+	ring->sq_tail = ring->sq_ring + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ring + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ring + p.sq_off.array;
+
+	ring->cq_head = ring->cq_ring + p.cq_off.head;
+	ring->cq_tail = ring->cq_ring + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ring + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ring + p.cq_off.cqes;
+
+	return 0;
+
+err_cq:
+	err = errno;
+	munmap(ring->cq_ring, ring->cq_ring_size);
+	errno = err;
+err_sq:
+	err = errno;
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	errno = err;
+err_close:
+	err = errno;
+	close(ring->fd);
+	errno = err;
+	return -1;
+} /* uring_init */
+
+
+/**
+ * Unmap the queues and close the ring
+ */
+void uring_exit(struct uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+} /* uring_exit */
+
+
+/**
+ * Get next free sqe, or NULL if the submission queue is full.
+ * The sqe is cleared and will be submitted by next uring_submit()
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+	unsigned head, tail, idx;
+	struct io_uring_sqe *sqe;
+
+	head = smp_load_acquire(ring->sq_head);
+	tail = *ring->sq_tail + ring->sq_pending;
+
+	if (tail - head >= ring->entries)
+		return NULL;
+
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	ring->sq_array[idx] = idx;
+	ring->sq_pending++;
+
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+} /* uring_get_sqe */
+
+
+/**
+ * Submit all prepared sqes and wait for at least wait_nr
+ * completions. Returns number of submitted sqes or -1
+ * with errno set.
+ */
+int uring_submit(struct uring *ring, unsigned wait_nr)
+{
+	unsigned flags = 0, submit;
+	int ret;
+
+	submit = ring->sq_pending;
+	smp_store_release(ring->sq_tail, *ring->sq_tail + submit);
+	ring->sq_pending = 0;
+
+	if (wait_nr)
+		flags |= IORING_ENTER_GETEVENTS;
+
+	do {
+		ret = sys_io_uring_enter(ring->fd, submit, wait_nr, flags);
+	} while ((ret == -1) && (errno == EINTR));
+
+	return ret;
+} /* uring_submit */
+
+
+/**
+ * Return completed cqe if there is any, NULL otherwise
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+	unsigned head;
+
+	head = *ring->cq_head;
+	if (head == smp_load_acquire(ring->cq_tail))
+		return NULL;
+
+	return &ring->cqes[head & *ring->cq_mask];
+} /* uring_peek_cqe */
+
+
+/**
+ * Mark the cqe returned by uring_peek_cqe() as consumed
+ */
+void uring_cqe_seen(struct uring *ring)
+{
+	smp_store_release(ring->cq_head, *ring->cq_head + 1);
+} /* uring_cqe_seen */
@@ -0,0 +1,51 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Minimal io_uring interface built directly on top of the system calls,
+ * so we do not depend on liburing. It only provides what test-discard
+ * needs: getting sqes, submitting them and reaping completions.
+ */
+
+#ifndef _URING_H
+#define _URING_H
+
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+	unsigned entries;
+
+	/* submission ring */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_pending;	/* sqes prepared but not submitted yet */
+	struct io_uring_sqe *sqes;
+
+	/* completion ring */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+extern int uring_init(struct uring *ring, unsigned entries);
+extern void uring_exit(struct uring *ring);
+extern struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+extern int uring_submit(struct uring *ring, unsigned wait_nr);
+extern struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+extern void uring_cqe_seen(struct uring *ring);
+
+#endif /* _URING_H */
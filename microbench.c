@@ -0,0 +1,190 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * What it does ?
+ * Measure the cost of the parts of test-discard on the hot path of every
+ * discard, without any device, so regressions of the tool are caught
+ * before they show up in the device numbers.
+ *
+ * usage:
+ *	microbench [ops]...
+ *
+ *	<what> <ops> <ns per op>
+ *
+ *	Every part is run ops times (1000000 by default) for each ops given,
+ *	trackers pick all blocks of a device of ops blocks.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "libs/timer.h"
+#include "libs/prng.h"
+#include "libs/histogram.h"
+#include "libs/tracker.h"
+#include "libs/trace.h"
+
+#define DEF_OPS		1000000ULL
+#define BENCH_TRACE	"microbench.trace"
+#define BENCH_SEED	42
+
+static const char *trackers[] = {"rbtree", "bitmap", "perm"};
+
+static void report(const char *what, uint64_t ops, uint64_t start)
+{
+	fprintf(stdout,"%-16s %12llu %10.3lf\n", what,
+		(unsigned long long)ops,
+		(double)timer_ns(timer_now() - start) / ops);
+}
+
+/* keep the compiler from throwing the benchmarked work away */
+static volatile uint64_t sink;
+
+int bench_timer(uint64_t ops) {
+	uint64_t i, start, sum = 0;
+
+	start = timer_now();
+	for (i = 0; i < ops; i++)
+		sum += timer_now();
+	report("timer", ops, start);
+	sink = sum;
+	return 0;
+} /* bench_timer */
+
+
+int bench_prng(uint64_t ops) {
+	struct prng rng;
+	uint64_t i, start, sum = 0;
+
+	prng_seed(&rng, BENCH_SEED);
+	start = timer_now();
+	for (i = 0; i < ops; i++)
+		sum += prng_bounded(&rng, ops);
+	report("prng", ops, start);
+	sink = sum;
+	return 0;
+} /* bench_prng */
+
+
+int bench_histogram(uint64_t ops) {
+	struct histogram hist;
+	struct prng rng;
+	uint64_t i, start;
+
+	hist_init(&hist);
+	prng_seed(&rng, BENCH_SEED);
+	start = timer_now();
+	for (i = 0; i < ops; i++)
+		hist_add(&hist, prng_next(&rng) >> 40);
+	sink = hist_percentile(&hist, 99);
+	report("histogram", ops, start);
+	return 0;
+} /* bench_histogram */
+
+
+/**
+ * Pick every block of the device, guess_next_block() for rbtree
+ */
+int bench_tracker(const char *name, uint64_t ops) {
+	struct tracker *t;
+	uint64_t i, start;
+	long long block;
+	char what[32];
+
+	if ((t = tracker_create(name, ops, BENCH_SEED)) == NULL)
+		return -1;
+
+	start = timer_now();
+	for (i = 0; i < ops; i++) {
+		if ((block = tracker_next(t)) == -1) {
+			fprintf(stderr,"Tracker %s failed after %llu blocks\n",
+				name, (unsigned long long)i);
+			tracker_destroy(t);
+			return -1;
+		}
+	}
+	snprintf(what, sizeof(what), "tracker %s", name);
+	report(what, ops, start);
+	sink = block;
+
+	tracker_destroy(t);
+	return 0;
+} /* bench_tracker */
+
+
+int bench_trace(uint64_t ops) {
+	struct trace trace;
+	uint64_t i, start;
+	int ret = 0;
+
+	if (trace_open(&trace, BENCH_TRACE) == -1)
+		return -1;
+	if (trace_reserve(&trace, ops) == -1) {
+		ret = -1;
+		goto out;
+	}
+
+	start = timer_now();
+	for (i = 0; i < ops; i++)
+		trace_add(&trace, i, i * 4096, 4096, 1000, 0);
+	report("trace", ops, start);
+
+out:
+	if (trace_close(&trace) == -1)
+		ret = -1;
+	unlink(BENCH_TRACE);
+	return ret;
+} /* bench_trace */
+
+
+int main (int argc, char **argv) {
+	uint64_t ops = DEF_OPS;
+	char *endptr;
+	unsigned i;
+	int n;
+
+	if (timer_init(TIMER_RAW) == -1)
+		return EXIT_FAILURE;
+
+	fprintf(stdout,"# timer %s overhead %llu ns\n", timer_name(),
+		(unsigned long long)timer_overhead);
+
+	for (n = 1; (n < argc) || (n == 1); n++) {
+		if (n < argc) {
+			errno = 0;
+			ops = strtoull(argv[n], &endptr, 0);
+			if (errno || (*endptr != '\0') || (ops == 0)) {
+				fprintf(stderr,"%s [ops]...\n", argv[0]);
+				return EXIT_FAILURE;
+			}
+		}
+
+		if ((bench_timer(ops) == -1) ||
+		    (bench_prng(ops) == -1) ||
+		    (bench_histogram(ops) == -1) ||
+		    (bench_trace(ops) == -1))
+			return EXIT_FAILURE;
+
+		for (i = 0; i < sizeof(trackers) / sizeof(trackers[0]); i++)
+			if (bench_tracker(trackers[i], ops) == -1)
+				return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+} /* main */
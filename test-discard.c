@@ -23,19 +23,91 @@
  *
  * usage: 
  *	<program> [-h] [-b] [-s start] [-r record_size] [-t total_size]
- *	[-d device] [-R start:end:step] [-z]
+ *	[-d device] [-R start:end:step] [-z] [-x] [-j threads] [-q depth]
+ *	[-T timer] [-B size] [-p num] [-g gap] [-k tracker] [-W size[:random]]
+ *	[--seed num]
+ *	[--trace file] [--interval time] [--plan] [--adaptive pct]
+ *	[--converge relerr[:pct]] [--min-ops num] [--max-ops num]
+ *	[--budget time] [--fg rw:bs[:depth[:start:size]]] [--align] [--centre]
+ *	[--op name] [--fitrim] [--minlen num] [--fragment size[:amount]]
+ *	[--ranges num] [--rate num] [--perf] [--no-prepare]
+ *	[--sim dist:latency[:depth]] [--pattern name] [--replay file[:scale]]
+ *	[--precondition passes[:seq|rand]] [--steady window[:range[:slope]]]
+ *	[--checkpoint file] [--resume file]
  *		
  *	-s num Starting point of the discard
  *	-r num Size of the record discarded in one step
  *	-R start:end:step Define record range to be tested
  *	-t num Total amount of discarded data
- *	-d dev Device which should be tested
+ *	-d dev Device which should be tested, more devices are tested in parallel
  *	-b     Output will be optimized for scripts
  *		
  *	 <record_size> <total_size> <min> <max> <avg> <sum> <throughput in MB/s>
+ *	 <p50> <p90> <p99> <p99.9> <p99.99> [<precision in %>]
+ *	 [<fg MB/s> <fg p50> <fg p99> with discard on, the same with it off]...
+ *	 [<minlen>] [<ranges per command> <avg per range>]
+ *	 [<kernel discards> <kernel avg size> <merge ratio> <discard time>
+ *	 <busy time>] [<cycles> <instructions> <context switches>
+ *	 <migrations> <page faults> <user us> <sys us>, all of them per op]
+ *	 [<rounds to the steady state, -1 if not reached>]
  *
  *	-z     Discard already discarded blocks
  *	-x     Run test witch random IO pattern [-s] will be ignored
+ *	-W size[:random] Confine random IO to the working set of size at [-s],
+ *	       or at a random place
+ *	-j num Number of threads issuing discards concurrently
+ *	-q num Use io_uring with num discards in flight per thread
+ *	-T raw|tsc Time source, CLOCK_MONOTONIC_RAW (default) or TSC
+ *	-B num Size of one device preparation write (default 4M)
+ *	-p num Number of preparation writes in flight (default 4)
+ *	-g num Merge discarded extents closer than num when preparing (64k)
+ *	-k rbtree|bitmap|perm Tracker of discarded blocks in random IO mode
+ *	--seed num Seed of the random IO pattern, to make runs reproducible
+ *	--trace file Log every discard into binary file, see trace2csv
+ *	--interval time Report progress every time (ns|us|ms|s, default s)
+ *
+ *	 <record_size> <elapsed> <ops> <bytes> <MB/s> <p99>
+ *
+ *	--plan Prepare device once for several steps of the sweep
+ *	--adaptive pct Refine [-R] sweep where throughput changes more than pct
+ *	--converge relerr[:pct] Stop the step when the 95% confidence interval
+ *	       of the mean (or of the pct percentile) is within relerr percent
+ *	--min-ops num Do not stop the step before num discards
+ *	--max-ops num Stop the step after num discards
+ *	--budget time Stop the step after time (ns|us|ms|s, default s)
+ *	--fg rw:bs[:depth[:start:size]] Run O_DIRECT reads or writes (rw is
+ *	       read or write) of bs at random offsets of the region along
+ *	       with discards, can be given more times
+ *	--align Align start and record size to the discard granularity
+ *	--centre Add record sizes around the discard limits to the [-R] sweep
+ *	--op discard|secdiscard|zeroout|punch|null|sim Operation to test
+ *	       (discard), null and sim do not touch the device
+ *	--fitrim [-d] is a mounted filesystem trimmed by FITRIM, the record
+ *	       is the range trimmed by one call
+ *	--minlen num|start:end:step FITRIM minimal extent length (0)
+ *	--fragment size[:amount] Before every step write amount (default
+ *	       [-t]) of data in files of size and remove every other one
+ *	--ranges num|start:end:step Discard by NVMe DSM passthrough commands
+ *	       carrying num ranges each
+ *	--rate num Issue num discards per second (bytes per second when num
+ *	       has a unit) on schedule, latency counts from the planned time
+ *	--perf Count CPU cost of the discards per op with perf events
+ *	--no-prepare Do not write the device before the steps
+ *	--sim fixed|uniform|exp:latency[:depth] Test simulated device with
+ *	       the latency distribution, serving at most depth ops at once
+ *	--pattern name Pattern of the random IO (uniform), one of uniform,
+ *	       strided:stride, zipf[:theta] or varlen:uniform|exp:mean
+ *	--replay file[:scale] Replay discards of the trace made by blk2replay
+ *	       with their times multiplied by scale (1), 0 back to back
+ *	--precondition passes[:seq|rand] Write the whole device (working set)
+ *	       passes times before the test, seq or in random order (seq)
+ *	--steady window[:range[:slope]] Repeat the step until the throughput
+ *	       of window rounds is steady within range and slope percent of
+ *	       the mean (20:10), then measure it
+ *	--checkpoint file Save the sweep position, the tracker and the
+ *	       pattern into file before every step and when interrupted
+ *	--resume file Continue the sweep checkpointed into file, with the
+ *	       same options, without preparing the device from scratch
  *	-h     Print this help
  *
  *	\"num\" can be specified either as a ordinary number, or as a
@@ -75,50 +147,227 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/statvfs.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
 #include <stdint.h>
-
-#include "libs/rbtree.h"
-
-/* Do not call BLKDISCARD ioctl() */
-/*#define DEBUG_NO_DISCARD*/
-
-/* Do not prepare device prior testing */
-/*#define DEBUG_NO_PREPARE*/
+#include <pthread.h>
+#include <math.h>
+#include <float.h>
+#include <ctype.h>
+#include <signal.h>
+
+#include "libs/uring.h"
+#include "libs/histogram.h"
+#include "libs/timer.h"
+#include "libs/tracker.h"
+#include "libs/trace.h"
+#include "libs/op.h"
+#include "libs/nvme.h"
+#include "libs/perf.h"
+#include "libs/pattern.h"
+#include "libs/replay.h"
 
 #define DEF_REC_SIZE 4096ULL		/* 4KB  */
 #define DEF_TOT_SIZE 10485760ULL	/* 10MB */
-
-#define ENT_SIZE 4096			/* size of entropy */
+#define MAX_THREADS 256			/* max number of discard workers */
+#define MAX_DEPTH 4096			/* max io_uring queue depth */
+#define MAX_FG 16			/* max number of foreground jobs */
+#define MAX_DEVICES 64			/* max number of tested devices */
+
+#define DEF_PREP_BUF 4194304		/* 4MB buffer per prep writer */
+#define DEF_PREP_DEPTH 4		/* prep writes in flight */
+#define DEF_PREP_GAP 65536ULL		/* 64KB */
+#define PREP_ALIGN 4096			/* O_DIRECT buffer alignment */
+#define FRAG_PATH (PATH_MAX + 32)	/* fragmenting file path size */
+#define WINDOW_ALIGN 1048576ULL	/* random working set placement */
+#define CONVERGE_CHECK 64		/* ops between convergence checks */
+#define CONF_Z 1.96			/* 95% confidence interval */
+#define RATE_SPIN 50000			/* spin instead of sleep below 50us */
+#define STEADY_MAX_ROUNDS 25		/* rounds to reach the steady state */
 
 #define BATCHOUT	1		/* batch output */
 #define DISCARD2	2		/* discard already discarded */
 #define RANDOMIO	4		/* random IO pattern */
+#define PLANSWEEP	8		/* place steps into prepared space */
+#define AUTOALIGN	16		/* align to the discard granularity */
+#define CENTRESWEEP	32		/* test around the discard limits */
+#define FITRIMFS	64		/* batched discard of a filesystem */
+#define PERFSTAT	128		/* count CPU cost of the test */
+#define NOPREPARE	256		/* do not write the device before steps */
+
+/* What the steps of the sweep change */
+#define SWEEP_RECORD	0		/* record size */
+#define SWEEP_MINLEN	1		/* FITRIM minimal extent length */
+#define SWEEP_RANGES	2		/* ranges per DSM command */
+
+/* Options without short equivalent */
+enum {
+	OPT_SEED = 256,
+	OPT_TRACE,
+	OPT_INTERVAL,
+	OPT_PLAN,
+	OPT_ADAPTIVE,
+	OPT_CONVERGE,
+	OPT_MIN_OPS,
+	OPT_MAX_OPS,
+	OPT_BUDGET,
+	OPT_FG,
+	OPT_ALIGN,
+	OPT_CENTRE,
+	OPT_OP,
+	OPT_FITRIM,
+	OPT_MINLEN,
+	OPT_FRAGMENT,
+	OPT_RANGES,
+	OPT_RATE,
+	OPT_PERF,
+	OPT_NO_PREPARE,
+	OPT_SIM,
+	OPT_PATTERN,
+	OPT_REPLAY,
+	OPT_PRECONDITION,
+	OPT_STEADY,
+	OPT_CHECKPOINT,
+	OPT_RESUME,
+};
 
 #define IS_HUMAN(x)		(~x & BATCHOUT)
 #define IS_DISCARD2(x)		(x & DISCARD2)
 #define IS_RANDOMIO(x)		(x & RANDOMIO)
+#define IS_PLANSWEEP(x)		(x & PLANSWEEP)
+#define IS_AUTOALIGN(x)		(x & AUTOALIGN)
+#define IS_CENTRESWEEP(x)	(x & CENTRESWEEP)
+#define IS_FITRIMFS(x)		(x & FITRIMFS)
+#define IS_PERFSTAT(x)		(x & PERFSTAT)
+#define IS_NOPREPARE(x)		(x & NOPREPARE)
+
+volatile sig_atomic_t stop;	/* set by the signals to wind down */
+uint64_t run_start;	/* timer ticks at the start of the run */
 
-int stop;
+/**
+ * Discard counters of the block device from /sys/block/<dev>/stat.
+ * Ticks are in milliseconds, sectors are always 512 bytes.
+ */
+struct blk_stat {
+	int valid;		/* kernel exports discard counters */
+	unsigned long long discards;	/* discard requests completed */
+	unsigned long long merges;	/* discards merged into them */
+	unsigned long long sectors;	/* sectors discarded */
+	unsigned long long ticks;	/* time spent on discards */
+	unsigned long long io_ticks;	/* time the device was busy */
+	unsigned long long inflight;	/* requests in flight */
+};
 
 /**
  * Structure for collecting statistics data
  */
 struct statistics {
-	double min;
-	double max;
-	double sum;
+	uint64_t min;		/* all durations are in nanoseconds */
+	uint64_t max;
+	uint64_t sum;
+	double sumsq;		/* sum of squares for the variance */
 	unsigned long count;
+	uint64_t bytes;		/* amount of data discarded */
+	uint64_t ranges;	/* ranges discarded by DSM commands */
+	uint64_t elapsed;	/* wall clock time of the whole step */
+	struct blk_stat blk;	/* what the kernel saw during the step */
+	struct perf_counts perf;	/* CPU cost of the step */
+	double utime, stime;	/* user and system time in seconds */
+	struct histogram hist;
+};
+
+#define NS_TO_S(x)	((double)(x) / 1000000000.0)
+#define TV_TO_S(x)	((x).tv_sec + (x).tv_usec / 1000000.0)
+
+/*
+ * Counters the reporter reads while the worker owning them updates
+ * them. There is just one writer, so a relaxed store is enough and
+ * costs no more than the plain one.
+ */
+#define STAT_ADD(x, v)	__atomic_store_n(&(x), (x) + (v), __ATOMIC_RELAXED)
+
+/* Percentiles reported in the results */
+static const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+#define NR_PERCENTILES	(sizeof(percentiles) / sizeof(percentiles[0]))
+
+
+/**
+ * Discard limits of the device from sysfs, 0 when not known
+ */
+struct discard_limits {
+	unsigned long long granularity;
+	unsigned long long alignment;	/* offset of the first granule */
+	unsigned long long max_bytes;	/* bigger discards are split */
+	unsigned long long max_hw_bytes;
+	unsigned long long zeroes_data;
+};
+
+/**
+ * Foreground reads or writes issued at random offsets of the region
+ * while the discards are running, and also without them to compare
+ */
+struct fg_job {
+	int write;			/* 1 for writes, 0 for reads */
+	unsigned long long block_size;
+	int depth;			/* requests in flight */
+	unsigned long long start;	/* region of the device */
+	unsigned long long size;	/* 0 for the rest of the device */
+	pthread_t thread;
+	int fd;
+	int err;
+	int done;			/* set to stop the job */
+	char *buf;
+	struct prng rng;
+	struct statistics *stats;	/* phase being measured */
+	struct statistics on;		/* with discards running */
+	struct statistics off;		/* without discards */
+};
+
+/**
+ * When to stop the test step before the total size is discarded
+ */
+struct converge {
+	double relerr;		/* target relative error, 0 if disabled */
+	double pct;		/* percentile to converge, 0 for the mean */
+	unsigned long min_ops;
+	unsigned long max_ops;	/* 0 if unlimited */
+	uint64_t budget;	/* time budget of the step in ns, 0 if unlimited */
+	uint64_t start;		/* timer ticks at the start of the step */
+	unsigned long next_check;
+};
+
+/**
+ * Steady state detection in the way of SNIA PTS. The step is repeated
+ * until the throughput of the last window rounds stays within range of
+ * their mean and the line fitted to them moves less than slope of the
+ * mean over the window, only then the step is measured.
+ */
+struct steady {
+	int window;		/* rounds of the window, 0 if disabled */
+	double range;		/* max range, fraction of the mean */
+	double slope;		/* max excursion of the fit, fraction */
+	int reached;		/* rounds to the steady state, -1 if never */
 };
 
+/**
+ * Simulated device
+ */
+struct sim_conf {
+	int dist;		/* OP_SIM_* latency distribution */
+	uint64_t latency;	/* ns */
+	int depth;		/* operations served at once, 0 for any */
+};
 
 /**
  * Structure for definitions of the run
@@ -128,10 +377,109 @@ struct definitions {
 	unsigned long long record_size;
 	unsigned long long total_size;
 	unsigned long long dev_size;
+	unsigned long long win_start;	/* random IO working set */
+	unsigned long long win_size;	/* 0 until set up, then the window */
+	int win_random;		/* place the working set randomly */
 	int dev_ssize;
+	struct discard_limits limits;
 	char target[PATH_MAX];
 	int fd;
+	int regular;		/* target is a regular file */
+	dev_t blk_dev;		/* block device doing the discards */
 	int flags;
+	const struct op_backend *op;	/* operation being tested */
+	int threads;		/* number of discard workers */
+	int depth;		/* io_uring queue depth, 0 for ioctl */
+	int ranges;		/* ranges per NVMe DSM command, 0 if not used */
+	struct nvme_ns ns;	/* namespace for the DSM commands */
+	unsigned long long rate;	/* ops/s of the open loop, 0 if closed */
+	int rate_bytes;		/* rate is in bytes/s, not ops/s */
+	struct replay *replay;	/* trace to replay, NULL if not */
+	double replay_scale;	/* of its times, 0 back to back */
+	uint64_t replay_first;	/* first record of this worker */
+	uint64_t replay_base;	/* ticks when the replay started */
+	unsigned long long prep_buf;	/* size of one prep write */
+	int prep_depth;		/* number of prep writes in flight */
+	unsigned long long prep_gap;	/* max gap merged by prepare_by_tree */
+	char tracker_name[16];	/* tracker of discarded blocks */
+	struct tracker *tracker;	/* shared by all workers */
+	struct pattern_conf pattern_conf;	/* random IO pattern */
+	struct pattern *pattern;	/* its state, under the tracker lock */
+	uint64_t seed;		/* seed of the random IO pattern */
+	struct trace *trace;	/* per operation log, NULL if disabled */
+	int worker;		/* id of the worker using this copy */
+	uint64_t interval;	/* reporting interval in ns, 0 if disabled */
+	struct converge conv;	/* early stopping of the step */
+	struct steady steady;	/* warm up rounds of the step */
+	int precond_passes;	/* full writes before the test */
+	int precond_random;	/* in random order of prep_buf chunks */
+	int resumed;		/* device is prepared by the checkpointed run */
+	struct fg_job *fg;	/* foreground jobs */
+	int nfg;
+	unsigned long long minlen;	/* FITRIM minimal extent length */
+	int sweep_by;		/* what the sweep changes, SWEEP_* */
+	unsigned long long frag_size;	/* size of fragmenting files */
+	unsigned long long frag_amount;	/* data written by fragmenting */
+};
+
+
+/**
+ * Structure for the thread periodically reporting progress of the
+ * test step. It only reads statistics of the workers, they are
+ * never locked nor slowed down by it.
+ */
+struct reporter {
+	pthread_t thread;
+	struct definitions *defs;
+	struct statistics **stats;	/* statistics of all workers */
+	int nstats;
+	int done;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long last_count;
+	uint64_t last_bytes;
+	uint64_t last_time;
+	uint64_t start_time;
+	struct histogram hist;		/* merged histogram of workers */
+	struct histogram last_hist;	/* the same at the previous report */
+};
+
+
+/**
+ * Structure describing one discard worker. Each worker
+ * has its own copy of definitions with its own fd and
+ * slice of the tested region and collects its own statistics
+ */
+struct worker {
+	pthread_t thread;
+	int id;
+	int err;
+	struct definitions defs;
+	struct statistics stats;
+};
+
+
+/**
+ * Byte range of the device to be written by the prep writers
+ */
+struct prep_run {
+	uint64_t start;
+	uint64_t size;
+};
+
+
+/**
+ * State shared by prep writers. Writers take buffer sized
+ * chunks from runs in order under the lock
+ */
+struct prep_job {
+	struct definitions *defs;
+	struct prep_run *runs;
+	unsigned long nruns;
+	unsigned long next_run;
+	uint64_t next_offset;	/* offset within the next run */
+	pthread_mutex_t lock;
+	int err;
 };
 
 
@@ -144,47 +492,105 @@ struct records {
 	unsigned long long step;
 };
 
+/**
+ * Prepared space of the device used by the sweep planner
+ */
+struct plan {
+	unsigned long long base;	/* start of the tested region */
+	unsigned long long total;	/* requested total size */
+	unsigned long long next;	/* first prepared byte not used yet */
+	unsigned long long end;		/* end of the prepared space */
+};
+
+/**
+ * Record sizes tested by the sweep in the order of testing
+ */
+struct sweep {
+	unsigned long long *sizes;
+	double *tput;		/* throughput measured with the size */
+	unsigned n;
+	unsigned cap;
+	double threshold;	/* adaptive sweep refinement, 0 if linear */
+};
 
 /**
- * Structure for creating tree of discarded
- * records
+ * Pair of record size and its throughput, for sorting
  */
-struct discarded_entry {
-	unsigned long long start;
-	unsigned long long count;
-	struct rb_node node;
+struct sweep_point {
+	unsigned long long size;
+	double tput;
 };
 
-struct rb_root discarded_root;
+/**
+ * One of the devices tested at the same time
+ */
+struct device {
+	struct definitions defs;	/* own copy with its size and fd */
+	struct plan plan;
+	struct statistics stats;	/* results of the last step */
+	struct sweep *sweep;
+	unsigned step;			/* index of the step in the sweep */
+	struct prng tracker_rng;	/* random IO state at the start */
+	struct prng pattern_rng;	/* of the step, for the checkpoint */
+	pthread_t thread;
+	int err;
+};
 
-void free_entry(struct discarded_entry **entry) {
-	free(*entry);
-	*entry = NULL;
-}
 
 /**
- * Free the tree
+ * Checkpoint of the sweep. The header is followed by the record sizes
+ * of the sweep with their throughput, then by every device, each with
+ * the image of its tracker in random IO mode.
  */
-void free_tree(void) {
-	struct rb_node *node, *next;
-	struct discarded_entry *entry;
+#define CKPT_MAGIC	0x54504b4344545354ULL	/* "TSTDCKPT" */
+#define CKPT_VERSION	2
+
+struct ckpt_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t ndevs;
+	uint32_t step;		/* step to continue with */
+	uint32_t nsizes;	/* record sizes of the sweep */
+	uint64_t seed;
+	int32_t flags;
+	int32_t sweep_by;
+};
 
-	for (node = rb_first(&discarded_root); node; node = next) {
-		next = rb_next(node);
-		entry = rb_entry(node, struct discarded_entry, node);
-		rb_erase(node, &discarded_root);
-		free_entry(&entry);
-	}
+struct ckpt_device {
+	char target[PATH_MAX];
+	uint64_t dev_size;
+	uint64_t win_start;
+	uint64_t win_size;
+	uint64_t record_size;
+	uint64_t total_size;
+	uint64_t start;
+	uint64_t minlen;
+	int32_t ranges;
+	int32_t tracker;	/* tracker image follows */
+	struct plan plan;
+	struct pattern_conf pattern_conf;
+	struct prng tracker_rng;	/* at the start of the step */
+	struct prng pattern_rng;
+};
 
-} /* free_tree */
+/**
+ * Checkpoint loaded by --resume
+ */
+struct checkpoint {
+	struct ckpt_header hdr;
+	uint64_t *sizes;
+	double *tput;
+	struct ckpt_device *devs;
+	struct tracker **trackers;
+};
 
 
 /**
- * Print critical error message, free list and exit
+ * Print critical error message, free tracker and exit
  */
-void crit_err(void) {
+void crit_err(struct definitions *defs) {
 	fprintf(stderr,"Critical failure: You found a BUG!\n");
-	free_tree();
+	tracker_destroy(defs->tracker);
 	exit(EXIT_FAILURE);
 } /* crit_err */
 
@@ -195,16 +601,86 @@ void crit_err(void) {
 void usage(char *program) {
 	fprintf(stdout, "%s [-h] [-b] [-s start] [-r record_size] "
 	"[-t total_size] [-d device] [-R start:end:step] \
-	[-z] [-x]\n\n\
+	[-z] [-x] [-j threads] [-q depth] [-T timer] [-B size] [-p num] [-g gap]\n\
+	[-k tracker] [-W size[:random]] [--seed num] [--trace file]\n\
+	[--interval time]\n\
+	[--plan] [--adaptive pct] [--converge relerr[:pct]] [--min-ops num]\n\
+	[--max-ops num] [--budget time] [--fg rw:bs[:depth[:start:size]]]\n\
+	[--align] [--centre] [--op name] [--fitrim] [--minlen num]\n\
+	[--fragment size[:amount]] [--ranges num] [--rate num] [--perf]\n\
+	[--no-prepare] [--sim dist:latency[:depth]] [--pattern name]\n\
+	[--replay file[:scale]] [--precondition passes[:seq|rand]]\n\
+	[--steady window[:range[:slope]]] [--checkpoint file]\n\
+	[--resume file]\n\n\
 	-s num Starting point of the discard\n\
 	-r num Size of the record discarded in one step\n\
 	-R start:end:step Define record range to be tested\n\
 	-t num Total amount of discarded data\n\
-	-d dev Device which should be tested\n\
+	-d dev Device which should be tested, more devices are tested in parallel\n\
 	-b     Output will be optimized for scripts\n\
 	<record_size> <total_size> <min> <max> <avg> <sum> <throughput in MB/s>\n\
+	<p50> <p90> <p99> <p99.9> <p99.99> [<precision in %%>]\n\
+	[<fg MB/s> <fg p50> <fg p99> with discard on, the same with it off]...\n\
+	[<minlen>] [<ranges per command> <avg per range>]\n\
+	[<kernel discards> <kernel avg size> <merge ratio> <discard time>\n\
+	<busy time>] [<cycles> <instructions> <context switches>\n\
+	<migrations> <page faults> <user us> <sys us>, all of them per op]\n\
+	[<rounds to the steady state, -1 if not reached>]\n\
 	-z     Discard already discarded blocks\n\
 	-x     Run test witch random IO pattern [-s] will be ignored\n\
+	-W size[:random] Confine random IO to the working set of size at [-s],\n\
+	       or at a random place\n\
+	-j num Number of threads issuing discards concurrently\n\
+	-q num Use io_uring with num discards in flight per thread\n\
+	-T raw|tsc Time source, CLOCK_MONOTONIC_RAW (default) or TSC\n\
+	-B num Size of one device preparation write (default 4M)\n\
+	-p num Number of preparation writes in flight (default 4)\n\
+	-g num Merge discarded extents closer than num when preparing (64k)\n\
+	-k rbtree|bitmap|perm Tracker of discarded blocks in random IO mode\n\
+	--seed num Seed of the random IO pattern, to make runs reproducible\n\
+	--trace file Log every discard into binary file, see trace2csv\n\
+	--interval time Report progress every time (ns|us|ms|s, default s)\n\
+	<record_size> <elapsed> <ops> <bytes> <MB/s> <p99>\n\
+	--plan Prepare device once for several steps of the sweep\n\
+	--adaptive pct Refine [-R] sweep where throughput changes more than pct\n\
+	--converge relerr[:pct] Stop the step when the 95%% confidence interval\n\
+	       of the mean (or of the pct percentile) is within relerr percent\n\
+	--min-ops num Do not stop the step before num discards\n\
+	--max-ops num Stop the step after num discards\n\
+	--budget time Stop the step after time (ns|us|ms|s, default s)\n\
+	--fg rw:bs[:depth[:start:size]] Run O_DIRECT reads or writes (rw is\n\
+	       read or write) of bs at random offsets of the region along\n\
+	       with discards, can be given more times\n\
+	--align Align start and record size to the discard granularity\n\
+	--centre Add record sizes around the discard limits to the [-R] sweep\n\
+	--op discard|secdiscard|zeroout|punch|null|sim Operation to test\n\
+	       (discard), null and sim do not touch the device\n\
+	--fitrim [-d] is a mounted filesystem trimmed by FITRIM, the record\n\
+	       is the range trimmed by one call\n\
+	--minlen num|start:end:step FITRIM minimal extent length (0)\n\
+	--fragment size[:amount] Before every step write amount (default\n\
+	       [-t]) of data in files of size and remove every other one\n\
+	--ranges num|start:end:step Discard by NVMe DSM passthrough commands\n\
+	       carrying num ranges each\n\
+	--rate num Issue num discards per second (bytes per second when num\n\
+	       has a unit) on schedule, latency counts from the planned time\n\
+	--perf Count CPU cost of the discards per op with perf events\n\
+	--no-prepare Do not write the device before the steps\n\
+	--sim fixed|uniform|exp:latency[:depth] Test simulated device with\n\
+	       the latency distribution, serving at most depth ops at once\n\
+	--pattern name Pattern of the random IO (uniform), one of uniform,\n\
+	       strided:stride, zipf[:theta] or varlen:uniform|exp:mean\n\
+	--replay file[:scale] Replay discards of the trace made by blk2replay\n\
+	       with their times multiplied by scale (1), 0 back to back\n\
+	--precondition passes[:seq|rand] Write the whole device (working set)\n\
+	       passes times before the test, seq or in random order (seq)\n\
+	--steady window[:range[:slope]] Repeat the step until the throughput\n\
+	       of window rounds is steady within range and slope %% of\n\
+	       the mean (20:10), then measure it\n\
+	--checkpoint file Save the sweep position, the tracker and the\n\
+	       pattern into file before every step and when interrupted\n\
+	--resume file Continue the sweep checkpointed into file, with the\n\
+	       same options, without preparing the device from scratch\n\
 	-h     Print this help\n\n\
 	\"num\" can be specified either as a ordinary number, or as a\n\
 	number followed by the unit. Supported units are\n\n\
@@ -221,632 +697,3844 @@ void usage(char *program) {
 
 
 /**
- * Get random block number on the disk
+ * Collect statistics of one discard operation
  */
-long int
-get_random_block(struct definitions *defs) 
-{
-	unsigned long long max;
+void add_sample(struct statistics *stats, uint64_t time) {
+	if (time > stats->max)
+		stats->max = time;
+	if (time < stats->min)
+		stats->min = time;
+	stats->sum += time;
+	stats->sumsq += (double)time * time;
+	STAT_ADD(stats->count, 1);
+	hist_add(&stats->hist, time);
+} /* add_sample */
+
 
-	max = defs->dev_size / defs->record_size;
-	if (max > RAND_MAX) {
-		fprintf(stderr,"Warning: I can not use whole disc.\n");
-		max = RAND_MAX;
+/**
+ * Relative half width of the confidence interval of the mean, or of
+ * the conv->pct percentile. The percentile interval is given by the
+ * ranks of the order statistics around it, so it does not assume
+ * anything about the distribution, but it can not be narrower than
+ * the histogram resolution.
+ */
+double get_precision(
+	struct converge *conv,
+	struct statistics *stats)
+{
+	double n = stats->count, mean, var, p, half;
+	uint64_t lo, hi, value;
+
+	if (stats->count < 2)
+		return DBL_MAX;
+
+	if (conv->pct == 0) {
+		mean = stats->sum / n;
+		if (mean == 0)
+			return 0;
+		var = (stats->sumsq - n * mean * mean) / (n - 1);
+		if (var < 0)
+			var = 0;
+		return CONF_Z * sqrt(var / n) / mean;
 	}
 
-	return (random() % max);
-} /* get_random_block */
+	p = conv->pct / 100.0;
+	half = CONF_Z * sqrt(n * p * (1 - p));
+	lo = (n * p > half) ? (uint64_t)(n * p - half) : 1;
+	hi = (uint64_t)(n * p + half) + 1;
+
+	if ((value = hist_percentile(&stats->hist, conv->pct)) == 0)
+		return 0;
+
+	return (hist_rank(&stats->hist, hi) - hist_rank(&stats->hist, lo))
+		/ 2.0 / value;
+} /* get_precision */
+
 
 /**
- * Allocate new item and initialize it with block 
- * values
+ * Check whether the step should stop before the total size is
+ * discarded, because we have got either enough or too many samples.
+ * The precision is computed only every CONVERGE_CHECK operations.
  */
-struct discarded_entry *alloc_and_init(long int block) {
-	struct discarded_entry *new = NULL;
+int check_converged(
+	struct converge *conv,
+	struct statistics *stats)
+{
+	conv->next_check = stats->count + CONVERGE_CHECK;
 
-	if ((new = malloc(sizeof(struct discarded_entry))) == NULL) {
-		perror("malloc");
-		return NULL;
-	}	
+	if (conv->budget &&
+	    (timer_ns(timer_now() - conv->start) >= conv->budget))
+		return 1;
+
+	if ((conv->relerr == 0) || (stats->count < conv->min_ops))
+		return 0;
+
+	return get_precision(conv, stats) <= conv->relerr;
+} /* check_converged */
+
+
+static inline int step_done(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	struct converge *conv = &defs->conv;
+
+	if (conv->max_ops && (stats->count >= conv->max_ops))
+		return 1;
 
-	new->start = block;
-	new->count = 1;
+	if (stats->count < conv->next_check)
+		return 0;
+
+	return check_converged(conv, stats);
+} /* step_done */
 
-	return new;
-} /* alloc_and_init */
 
 /**
- * Guess the next block in three steps :
- * 1. Get random block
- * 2. Search for the matching extent
- * 3. If not found create new one, otherwise extend existing
- * 4. See if we can merge to the right
+ * Account finished discard operation of the range started and
+ * completed at given timer ticks
  */
-int guess_next_block(struct definitions *defs) 
+static inline void account_op(
+	struct definitions *defs,
+	struct statistics *stats,
+	uint64_t time_start,
+	uint64_t time_stop,
+	uint64_t *range)
 {
-	long int block;
-	struct rb_node *parent = NULL, **n = &discarded_root.rb_node;
-	struct discarded_entry *entry, *new_entry;
-	struct rb_node *new_node, *node;
+	uint64_t time = timer_sample(time_start, time_stop);
 
-	block = get_random_block(defs);
+	add_sample(stats, time);
+	STAT_ADD(stats->bytes, range[1]);
 
-	while (*n) {
-		parent = *n;
-		entry = rb_entry(parent, struct discarded_entry, node);
+	if (defs->trace)
+		trace_add(defs->trace, timer_ns(time_start - run_start),
+			  range[0], range[1], time, defs->worker);
+} /* account_op */
 
-		if (block < entry->start) {
-			n = &(*n)->rb_left;
-		} else if (block > (entry->start + entry->count)) {
-			n = &(*n)->rb_right;
-		} else {
-			long int end = entry->start + entry->count;
 
-			if (end > (defs->dev_size / defs->record_size)) {
-				block = 0;
-				n = &discarded_root.rb_node;
-				continue;
-			}
+/**
+ * Ticks between two discards of one worker in the open loop, the
+ * rate is shared by all workers. With the rate in bytes one discard
+ * (or DSM command) carries record_size bytes of every range.
+ */
+uint64_t rate_period(struct definitions *defs) {
+	double ops = defs->rate;
 
-			entry->count += 1;
-			block = end;
-			new_entry = entry;
-			new_node = &new_entry->node;
-			goto skip_insert;
-		}
+	if (defs->rate_bytes)
+		ops /= (double)defs->record_size *
+		       (defs->ranges ? defs->ranges : 1);
+
+	return timer_ticks(1000000000.0 * defs->threads / ops);
+} /* rate_period */
+
+
+/**
+ * Wait for the intended send time of the next discard of the open
+ * loop and move the schedule on behind it. The latency is measured
+ * from the intended time, so the discards delayed by the slow previous
+ * ones count the delay too and the tail is not hidden by the device
+ * slowing the load down (coordinated omission).
+ */
+static inline uint64_t rate_wait(
+	struct definitions *defs,
+	uint64_t *next,
+	uint64_t period)
+{
+	uint64_t intended = *next, now, ns;
+	struct timespec ts;
+
+	*next += period;
+
+	while ((now = timer_now()) < intended) {
+		ns = timer_ns(intended - now);
+		if (ns <= RATE_SPIN)
+			continue;
+		ns -= RATE_SPIN;
+		ts.tv_sec = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		nanosleep(&ts, NULL);
 	}
+	return intended;
+} /* rate_wait */
 
-	if ((new_entry = alloc_and_init(block)) == NULL)
-		return -1;
-	new_node = &new_entry->node;
-	rb_link_node(new_node, parent, n);
-	rb_insert_color(new_node, &discarded_root);
 
-skip_insert:
-	/* See if we can merge to the right */
-	node = rb_next(new_node);
-	if (node) {
-		entry = rb_entry(node, struct discarded_entry, node);
-		if (entry->start == new_entry->start + new_entry->count) {
-			new_entry->count += entry->count;
-			rb_erase(node, &discarded_root);
-			free_entry(&entry);
+/**
+ * Fill in the range for the next discard. The position moves by
+ * record_size on every call in both modes, in random IO mode it
+ * only counts how much data we have discarded so far.
+ * Returns 1 if there is a range to discard, 0 when total_size
+ * is exhausted and -1 on error.
+ */
+int next_range(
+	struct definitions *defs,
+	uint64_t *position,
+	uint64_t *range)
+{
+	unsigned long long count;
+	long long block;
+
+	if (*position >= (defs->total_size + defs->start))
+		return 0;
+
+	if (IS_RANDOMIO(defs->flags)) {
+
+		pthread_mutex_lock(&defs->tracker->lock);
+		block = pattern_next(defs->pattern, defs->tracker, &count);
+		pthread_mutex_unlock(&defs->tracker->lock);
+		if (block == -1) {
+			return -1;
+		}
+
+		range[0] = defs->win_start + block * defs->record_size;
+		range[1] = count * defs->record_size;
+
+		if ((range[0] + range[1]) > defs->win_start + defs->win_size) {
+			range[1] = defs->win_start + defs->win_size - range[0];
+		}
+		/* an extent must not outrun the total size */
+		if ((*position + range[1]) > (defs->total_size + defs->start)) {
+			range[1] = defs->total_size + defs->start - *position;
 		}
+	} else {
+		range[0] = *position;
+		range[1] = defs->record_size;
 	}
 
-	return block;
+	*position += range[1];
+	return 1;
+} /* next_range */
+
+
+/**
+ * Open the tested device, or the filesystem in the FITRIM mode
+ */
+int open_target(struct definitions *defs) {
+	if (IS_FITRIMFS(defs->flags))
+		return open(defs->target, O_RDONLY | O_DIRECTORY);
+
+	return open(defs->target, O_RDWR);
+} /* open_target */
 
-} /* guess_next_block */
 
 /**
  * Discards defined amount of data on the device by issuing ioctl with defined 
  * record size as many times as needed to fill total_size. 
  */
-int run_ioctl(
+int ioctl_loop(
 	struct definitions *defs,
 	struct statistics *stats) 
 {
-	uint64_t next_hop, next_start;
-	double time;
-	struct timeval tv_start, tv_stop;
-	long int block;
-	uint64_t range[2];
+	uint64_t position;
+	uint64_t time_start, time_stop;
+	uint64_t range[2], next, period = 0;
+	int ret;
 
-	/* Sanity check */
-	if ((defs->record_size < 1) || 
-		(defs->total_size < defs->record_size)) 
-	{
-		fprintf(stderr,
-			"Insane boundaries! Block size = %llu,"
-			" Total size = %llu\n"
-			,defs->record_size,defs->total_size);
-		return 1;
-	}
-	
-	next_start = defs->start;
-	next_hop = next_start + defs->record_size;
+	position = defs->start;
+	if (defs->rate)
+		period = rate_period(defs);
+	next = timer_now();
 
 	/* ioctl loop */
-	stop=0;
-	while (!stop) {
+	while (!stop && !step_done(defs, stats)) {
 
-		if (next_hop >= (defs->total_size + defs->start)) {
-			next_hop = (defs->total_size + defs->start);
-			stop = 1;
+		if ((ret = next_range(defs, &position, range)) != 1) {
+			return (ret == -1);
 		}
 
-		if (IS_RANDOMIO(defs->flags)) {
-			
-			if ((block = guess_next_block(defs)) == -1) {
-				return 1;
-			}
-
-			range[0] = block * defs->record_size;
-			range[1] = defs->record_size;
-
-			if ((range[0] + range[1]) > defs->dev_size) {
-				range[1] = defs->dev_size - range[0];
-			}
-		} else {
-			range[0] = next_start;
-			range[1] = defs->record_size;
-		}
+		if (defs->rate)
+			time_start = rate_wait(defs, &next, period);
+		else
+			time_start = timer_now();
 
-		if (gettimeofday(&tv_start, (struct timezone *) NULL) == -1) {
-			perror("gettimeofday");
+		if (defs->op->issue(defs->fd, range) == -1) {
+			perror(defs->op->call);
 			return 1;
 		}
 
-#ifndef DEBUG_NO_DISCARD
-		if (ioctl(defs->fd, BLKDISCARD, &range) == -1) {
-			perror("Ioctl BLKDISCARD");
-			return 1;
-		}
-#endif
+		time_stop = timer_now();
 
-		if (gettimeofday(&tv_stop, (struct timezone *) NULL) == -1) {
-			perror("gettimeofday");
-			return 1;
-		}
-	
-		/* time diff */	
-		time = (double) tv_stop.tv_sec + \
-			(((double) tv_stop.tv_usec) * 0.000001);
-		time -= (double) tv_start.tv_sec + \
-			(((double) tv_start.tv_usec) * 0.000001);
-	
 		/* collect some statistics */
-		if (time > stats->max)
-			stats->max = time;
-		if (time < stats->min)
-			stats->min = time;
-		stats->sum += time;
-		stats->count++;
-
-		next_start = next_hop;
-		next_hop += defs->record_size;
+		account_op(defs, stats, time_start, time_stop, range);
 	}
 	return 0;
-} /* run_ioctl */
+} /* ioctl_loop */
 
 
 /**
- * Get the number from argument. It can be number followed by
- * units: k|K,m|M,g|G
+ * Discards defined amount of data the same way as ioctl_loop() does,
+ * but keeps up to defs->depth discards in flight through io_uring.
+ * Every discard is timed from its submission to its completion.
  */
-unsigned long long 
-get_number(char **optarg) {
-	char *opt;
-	unsigned long long number,max;
+int uring_loop(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	struct uring ring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	uint64_t *submitted, (*ranges)[2], now;
+	uint64_t position;
+	uint64_t range[2];
+	unsigned inflight = 0, slot, *free_slots, nfree;
+	int ret = 0, done = 0;
 
-	/* get the max to avoid overflow */
-	max = ULLONG_MAX / 10;
-	number = 0;
-	opt = *optarg;
-	
-	/* compute the number */
-	while ((*opt >= '0') && (*opt <= '9') && (number < max)) {
-		number = number * 10 + *opt++ - '0';
+	if (uring_init(&ring, defs->depth) == -1) {
+		perror("io_uring_setup");
+		return 1;
 	}
-	while (1) {
-		/* determine if units are defined */
-		switch(*opt++) {
-			case 'K': /* kilobytes */
-			case 'k': 
-				number *= 1024;
+
+	submitted = malloc(sizeof(uint64_t) * defs->depth);
+	ranges = malloc(sizeof(*ranges) * defs->depth);
+	free_slots = malloc(sizeof(unsigned) * defs->depth);
+	if (!submitted || !ranges || !free_slots) {
+		perror("malloc");
+		ret = 1;
+		goto out;
+	}
+	for (nfree = 0; nfree < (unsigned)defs->depth; nfree++)
+		free_slots[nfree] = nfree;
+
+	position = defs->start;
+
+	while (!done || inflight) {
+
+		/* fill the queue */
+		while (!done && !stop && nfree) {
+
+			if (step_done(defs, stats)) {
+				ret = 0;
+				done = 1;
 				break;
-			case 'M': /* megabytes */
-			case 'm':
-				number *= 1024 * 1024;
+			}
+
+			if ((ret = next_range(defs, &position, range)) != 1) {
+				ret = (ret == -1);
+				done = 1;
 				break;
-			case 'G': /* gigabytes */
-			case 'g':
-				number *= 1024 * 1024 * 1024;
+			}
+			ret = 0;
+
+			/* can not happen, the ring is at least depth long */
+			if ((sqe = uring_get_sqe(&ring)) == NULL) {
+				fprintf(stderr, "io_uring submission queue "
+					"is full\n");
+				ret = 1;
+				done = 1;
 				break;
-			case ':': /* delimiter */
-				if ((number > max) || (number == 0)) {
-					fprintf(stderr,"Numeric argument "
-						"out of range\n");
-					return 0;
-				}
-				*optarg = opt;
-				return number;
-			case '\0': /* end of the string */
-				if ((number > max) || (number == 0)) {
-					fprintf(stderr,"Numeric argument "
-						"out of range\n");
-					return 0;
-				}
-				return number;
-			default:
-				fprintf(stderr,"Bad syntax of "
-					"numeric argument\n");
-				return 0;
+			}
+
+			slot = free_slots[--nfree];
+			defs->op->prep_sqe(sqe, defs->fd, range);
+			sqe->user_data = slot;
+
+			ranges[slot][0] = range[0];
+			ranges[slot][1] = range[1];
+			submitted[slot] = timer_now();
+			inflight++;
+		}
+		if (stop)
+			done = 1;
+
+		if (!inflight)
+			break;
+
+		if (uring_submit(&ring, 1) == -1) {
+			perror("io_uring_enter");
+			ret = 1;
+			break;
+		}
+
+		/* reap completions */
+		while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+
+			now = timer_now();
+			slot = cqe->user_data;
+			if (cqe->res < 0) {
+				fprintf(stderr, "io_uring %s: %s\n",
+					defs->op->name, strerror(-cqe->res));
+				ret = 1;
+				done = 1;
+			} else {
+				account_op(defs, stats, submitted[slot], now,
+					   ranges[slot]);
+			}
+
+			uring_cqe_seen(&ring);
+			free_slots[nfree++] = slot;
+			inflight--;
 		}
 	}
-	return number;
-} /* get_number */
+
+out:
+	free(submitted);
+	free(ranges);
+	free(free_slots);
+	uring_exit(&ring);
+	return ret;
+} /* uring_loop */
 
 
 /**
- * Get the record ranges from the format start:end:step
+ * Trims free space of the filesystem by FITRIM ioctl the same way as
+ * ioctl_loop() discards, every call trims one record of the filesystem
+ * address space. Amount of data really trimmed is accounted.
  */
-int get_range(char *optarg,struct records *rec) {
-	char *opt;
+int fitrim_loop(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	struct fstrim_range trim;
+	uint64_t position;
+	uint64_t time_start, time_stop;
+	uint64_t range[2];
+	int ret;
 
-	opt = optarg;
+	position = defs->start;
 
-	if ((rec->start = get_number(&opt)) == 0) {
-		return 0;
-	}
-	if ((rec->end = get_number(&opt)) == 0) {
+	while (!stop && !step_done(defs, stats)) {
+
+		if ((ret = next_range(defs, &position, range)) != 1) {
+			return (ret == -1);
+		}
+
+		trim.start = range[0];
+		trim.len = range[1];
+		trim.minlen = defs->minlen;
+
+		time_start = timer_now();
+
+		if (ioctl(defs->fd, FITRIM, &trim) == -1) {
+			perror("Ioctl FITRIM");
+			return 1;
+		}
+
+		time_stop = timer_now();
+
+		/* kernel tells how much was trimmed */
+		range[1] = trim.len;
+		account_op(defs, stats, time_start, time_stop, range);
+	}
+	return 0;
+} /* fitrim_loop */
+
+
+/**
+ * Discards as ioctl_loop() does, but packs defs->ranges consecutive
+ * ranges of the pattern into one NVMe DSM deallocate command. The
+ * command is one operation of the statistics, every range of it is
+ * traced with the latency of the whole command.
+ */
+int nvme_loop(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	struct nvme_dsm_range buf[NVME_DSM_MAX_RANGES];
+	uint64_t ranges[NVME_DSM_MAX_RANGES][2];
+	uint64_t position, bytes, time, time_start, time_stop;
+	uint64_t next, period = 0;
+	int i, nr, ret = 0;
+
+	position = defs->start;
+	if (defs->rate)
+		period = rate_period(defs);
+	next = timer_now();
+
+	while (!stop && !step_done(defs, stats)) {
+
+		for (nr = bytes = 0; nr < defs->ranges; nr++) {
+			if ((ret = next_range(defs, &position,
+					      ranges[nr])) != 1)
+				break;
+			bytes += ranges[nr][1];
+		}
+		if (ret == -1)
+			return 1;
+		if (nr == 0)
+			return 0;
+
+		if (defs->rate)
+			time_start = rate_wait(defs, &next, period);
+		else
+			time_start = timer_now();
+
+		if (nvme_dsm(&defs->ns, buf, ranges, nr) == -1) {
+			perror("Ioctl NVME_IOCTL_IO_CMD");
+			return 1;
+		}
+
+		time_stop = timer_now();
+
+		time = timer_sample(time_start, time_stop);
+		add_sample(stats, time);
+		STAT_ADD(stats->bytes, bytes);
+		stats->ranges += nr;
+
+		for (i = 0; defs->trace && (i < nr); i++)
+			trace_add(defs->trace,
+				  timer_ns(time_start - run_start),
+				  ranges[i][0], ranges[i][1], time,
+				  defs->worker);
+	}
+	return 0;
+} /* nvme_loop */
+
+
+/**
+ * Replays the discards of the trace through the backend with their
+ * original times multiplied by replay_scale, or back to back when the
+ * scale is zero. Every worker issues each threads-th record from its
+ * first one, so the workers together keep the schedule. Like in the
+ * open loop of --rate a discard is timed from its planned time.
+ */
+int replay_loop(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	const struct replay_rec *rec;
+	uint64_t time_start, time_stop;
+	uint64_t i, range[2], next;
+
+	for (i = defs->replay_first; i < defs->replay->count;
+	     i += defs->threads) {
+
+		if (stop || step_done(defs, stats))
+			break;
+
+		rec = &defs->replay->recs[i];
+		range[0] = rec->offset;
+		range[1] = rec->length;
+
+		if (defs->replay_scale > 0) {
+			next = defs->replay_base +
+			       timer_ticks(rec->time * defs->replay_scale);
+			time_start = rate_wait(defs, &next, 0);
+		} else {
+			time_start = timer_now();
+		}
+
+		if (defs->op->issue(defs->fd, range) == -1) {
+			perror(defs->op->call);
+			return 1;
+		}
+
+		time_stop = timer_now();
+
+		account_op(defs, stats, time_start, time_stop, range);
+	}
+	return 0;
+} /* replay_loop */
+
+
+/**
+ * Run the discard loop with the backend selected for this run
+ */
+int run_loop(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	if (IS_FITRIMFS(defs->flags))
+		return fitrim_loop(defs, stats);
+
+	if (defs->replay)
+		return replay_loop(defs, stats);
+
+	if (defs->ranges)
+		return nvme_loop(defs, stats);
+
+	if (defs->depth)
+		return uring_loop(defs, stats);
+
+	return ioctl_loop(defs, stats);
+} /* run_loop */
+
+
+/**
+ * Run the discard loop and count the CPU time of the calling thread
+ * only, so that other devices, foreground jobs and the reporter
+ * running meanwhile are left out
+ */
+int discard_loop(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	struct rusage ru_start, ru_stop;
+	int err;
+
+	if (!IS_PERFSTAT(defs->flags))
+		return run_loop(defs, stats);
+
+	getrusage(RUSAGE_THREAD, &ru_start);
+	err = run_loop(defs, stats);
+	getrusage(RUSAGE_THREAD, &ru_stop);
+
+	stats->utime += TV_TO_S(ru_stop.ru_utime) -
+			TV_TO_S(ru_start.ru_utime);
+	stats->stime += TV_TO_S(ru_stop.ru_stime) -
+			TV_TO_S(ru_start.ru_stime);
+	return err;
+} /* discard_loop */
+
+
+/**
+ * Initialize statistic structure
+ */
+void init_stats(struct statistics *stats) {
+	stats->min = UINT64_MAX;
+	stats->max = 0;
+	stats->sum = 0;
+	stats->sumsq = 0;
+	stats->count = 0;
+	stats->bytes = 0;
+	stats->ranges = 0;
+	memset(&stats->blk, 0, sizeof(stats->blk));
+	memset(&stats->perf, 0, sizeof(stats->perf));
+	stats->utime = 0;
+	stats->stime = 0;
+	stats->elapsed = 0;
+	hist_init(&stats->hist);
+} /* init_stats */
+
+
+/**
+ * Add statistics collected by one worker to the total
+ */
+void merge_stats(struct statistics *dst, struct statistics *src) {
+	int i;
+
+	if (src->count == 0)
+		return;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	dst->sum += src->sum;
+	dst->sumsq += src->sumsq;
+	dst->count += src->count;
+	dst->bytes += src->bytes;
+	dst->ranges += src->ranges;
+	dst->blk.valid |= src->blk.valid;
+	dst->blk.discards += src->blk.discards;
+	dst->blk.merges += src->blk.merges;
+	dst->blk.sectors += src->blk.sectors;
+	dst->blk.ticks += src->blk.ticks;
+	dst->blk.io_ticks += src->blk.io_ticks;
+	dst->blk.inflight += src->blk.inflight;
+	for (i = 0; i < PERF_NR; i++)
+		dst->perf.val[i] += src->perf.val[i];
+	dst->perf.valid |= src->perf.valid;
+	dst->utime += src->utime;
+	dst->stime += src->stime;
+	hist_merge(&dst->hist, &src->hist);
+} /* merge_stats */
+
+
+/**
+ * Print what was discarded since the last report. The workers update
+ * the count, bytes and histogram buckets with relaxed atomic stores
+ * while we read them, so the numbers may be off by an operation or
+ * two, which does not matter here.
+ */
+void report_interval(struct reporter *r, uint64_t now) {
+	struct statistics *st;
+	unsigned long count = 0;
+	uint64_t bytes = 0, time, p99, total;
+	unsigned b;
+	int n;
+
+	hist_init(&r->hist);
+	for (n = 0; n < r->nstats; n++) {
+		st = r->stats[n];
+		count += __atomic_load_n(&st->count, __ATOMIC_RELAXED);
+		bytes += __atomic_load_n(&st->bytes, __ATOMIC_RELAXED);
+		for (b = 0; b < HIST_BUCKETS; b++)
+			r->hist.buckets[b] += __atomic_load_n(
+				&st->hist.buckets[b], __ATOMIC_RELAXED);
+	}
+
+	/* histogram of this interval only */
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		total = r->hist.buckets[b];
+		r->hist.buckets[b] -= r->last_hist.buckets[b];
+		r->hist.count += r->hist.buckets[b];
+		r->last_hist.buckets[b] = total;
+	}
+	p99 = hist_percentile(&r->hist, 99);
+
+	time = timer_ns(now - r->last_time);
+	if (time == 0)
+		time = 1;
+
+	fprintf(IS_HUMAN(r->defs->flags) ? stdout : stderr,
+		"%s%llu %lf %lu %llu %lf %.9lf\n",
+		IS_HUMAN(r->defs->flags) ? "interval " : "",
+		r->defs->record_size,
+		NS_TO_S(timer_ns(now - r->start_time)),
+		count - r->last_count,
+		(unsigned long long)(bytes - r->last_bytes),
+		((bytes - r->last_bytes) / (1024.0 * 1024.0)) / NS_TO_S(time),
+		NS_TO_S(p99));
+
+	r->last_count = count;
+	r->last_bytes = bytes;
+	r->last_time = now;
+} /* report_interval */
+
+
+/**
+ * Reporter thread entry point
+ */
+void *reporter_thread(void *arg) {
+	struct reporter *r = (struct reporter *)arg;
+	struct timespec deadline;
+	uint64_t next;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	next = (uint64_t)deadline.tv_sec * 1000000000ULL + deadline.tv_nsec;
+
+	pthread_mutex_lock(&r->lock);
+	while (!r->done) {
+		next += r->defs->interval;
+		deadline.tv_sec = next / 1000000000ULL;
+		deadline.tv_nsec = next % 1000000000ULL;
+
+		while (!r->done && (pthread_cond_timedwait(&r->cond,
+		       &r->lock, &deadline) != ETIMEDOUT))
+			;
+		if (r->done)
+			break;
+
+		report_interval(r, timer_now());
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	/* what is left from the last interval */
+	report_interval(r, timer_now());
+
+	return NULL;
+} /* reporter_thread */
+
+
+/**
+ * Start reporting progress of the statistics if requested
+ */
+int start_reporter(
+	struct reporter *r,
+	struct definitions *defs,
+	struct statistics **stats,
+	int nstats)
+{
+	pthread_condattr_t attr;
+
+	memset(r, 0, sizeof(*r));
+	if (defs->interval == 0)
+		return 0;
+
+	r->defs = defs;
+	r->stats = stats;
+	r->nstats = nstats;
+	r->start_time = r->last_time = timer_now();
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&r->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&r->lock, NULL);
+
+	if ((errno = pthread_create(&r->thread, NULL,
+	     reporter_thread, r)) != 0) {
+		perror("pthread_create");
+		r->defs = NULL;
+		return -1;
+	}
+
+	return 0;
+} /* start_reporter */
+
+
+/**
+ * Wake the reporter up, let it print the last interval and wait for it
+ */
+void stop_reporter(struct reporter *r) {
+	if (r->defs == NULL)
+		return;
+
+	pthread_mutex_lock(&r->lock);
+	r->done = 1;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+
+	pthread_join(r->thread, NULL);
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+} /* stop_reporter */
+
+
+/**
+ * Worker thread entry point
+ */
+void *worker_thread(void *arg) {
+	struct worker *w = (struct worker *)arg;
+
+	w->err = discard_loop(&w->defs, &w->stats);
+
+	return NULL;
+} /* worker_thread */
+
+
+/**
+ * Split the tested region into disjoint slices, one per worker, and
+ * run the ioctl loop in all of them concurrently. Every worker opens
+ * the device on its own so the requests are not serialized on a
+ * single file descriptor. In random IO mode the slices make no sense,
+ * so each worker only gets its share of total_size and blocks are
+ * picked from the shared tree.
+ */
+int run_workers(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	struct worker *workers;
+	struct statistics **live;
+	struct reporter reporter;
+	unsigned long long records, share, offset;
+	int i, started, err = 0;
+
+	workers = calloc(defs->threads, sizeof(struct worker));
+	live = calloc(defs->threads, sizeof(struct statistics *));
+	if (!workers || !live) {
+		perror("calloc");
+		free(workers);
+		free(live);
+		return 1;
+	}
+
+	for (i = 0; i < defs->threads; i++) {
+		init_stats(&workers[i].stats);
+		live[i] = &workers[i].stats;
+	}
+	if (start_reporter(&reporter, defs, live, defs->threads) == -1) {
+		free(workers);
+		free(live);
+		return 1;
+	}
+
+	records = defs->total_size / defs->record_size;
+	offset = defs->start;
+
+	for (started = 0; started < defs->threads; started++) {
+		struct worker *w = &workers[started];
+
+		/* spread the remainder over the first workers */
+		share = records / defs->threads;
+		if ((unsigned long long)started < (records % defs->threads))
+			share++;
+
+		w->id = started;
+		w->defs = *defs;
+		w->defs.worker = defs->worker + started;
+		w->defs.replay_first = started;
+		w->defs.conv.min_ops =
+			(defs->conv.min_ops + defs->threads - 1) / defs->threads;
+		w->defs.conv.max_ops =
+			(defs->conv.max_ops + defs->threads - 1) / defs->threads;
+		w->defs.start = offset;
+		w->defs.total_size = share * defs->record_size;
+		offset += w->defs.total_size;
+
+		/* nothing to do for this one */
+		if (share == 0) {
+			w->defs.fd = -1;
+			continue;
+		}
+
+		if ((w->defs.fd = open_target(defs)) == -1) {
+			perror("Opening block device");
+			err = 1;
+			break;
+		}
+
+		if ((errno = pthread_create(&w->thread, NULL,
+		     worker_thread, w)) != 0) {
+			perror("pthread_create");
+			close(w->defs.fd);
+			w->defs.fd = -1;
+			err = 1;
+			break;
+		}
+	}
+
+	/* ask already running workers to stop on error */
+	if (err)
+		stop = 1;
+
+	for (i = 0; i < started; i++) {
+		struct worker *w = &workers[i];
+
+		if (w->defs.fd == -1)
+			continue;
+
+		pthread_join(w->thread, NULL);
+		close(w->defs.fd);
+
+		if (w->err)
+			err = 1;
+	}
+	stop_reporter(&reporter);
+
+	for (i = 0; i < started; i++)
+		merge_stats(stats, &workers[i].stats);
+
+	free(workers);
+	free(live);
+	return err;
+} /* run_workers */
+
+
+/**
+ * Run the discard test either in the current thread or split
+ * it between defs->threads workers
+ */
+int run_ioctl(
+	struct definitions *defs,
+	struct statistics *stats) 
+{
+	struct reporter reporter;
+	int err;
+
+	/* Sanity check */
+	if ((defs->record_size < 1) || 
+		(defs->total_size < defs->record_size)) 
+	{
+		fprintf(stderr,
+			"Insane boundaries! Block size = %llu,"
+			" Total size = %llu\n"
+			,defs->record_size,defs->total_size);
+		return 1;
+	}
+
+	/* the workers keep to the same replay schedule */
+	defs->replay_first = 0;
+	defs->replay_base = timer_now();
+
+	if (defs->threads > 1)
+		return run_workers(defs, stats);
+
+	if (start_reporter(&reporter, defs, &stats, 1) == -1)
+		return 1;
+
+	err = discard_loop(defs, stats);
+
+	stop_reporter(&reporter);
+	return err;
+} /* run_ioctl */
+
+
+/**
+ * Get the number from argument. It can be number followed by
+ * units: k|K,m|M,g|G
+ */
+unsigned long long 
+get_number(char **optarg) {
+	char *opt;
+	unsigned long long number,max;
+
+	/* get the max to avoid overflow */
+	max = ULLONG_MAX / 10;
+	number = 0;
+	opt = *optarg;
+	
+	/* compute the number */
+	while ((*opt >= '0') && (*opt <= '9') && (number < max)) {
+		number = number * 10 + *opt++ - '0';
+	}
+	while (1) {
+		/* determine if units are defined */
+		switch(*opt++) {
+			case 'K': /* kilobytes */
+			case 'k': 
+				number *= 1024;
+				break;
+			case 'M': /* megabytes */
+			case 'm':
+				number *= 1024 * 1024;
+				break;
+			case 'G': /* gigabytes */
+			case 'g':
+				number *= 1024 * 1024 * 1024;
+				break;
+			case ':': /* delimiter */
+				if ((number > max) || (number == 0)) {
+					fprintf(stderr,"Numeric argument "
+						"out of range\n");
+					return 0;
+				}
+				*optarg = opt;
+				return number;
+			case '\0': /* end of the string */
+				if ((number > max) || (number == 0)) {
+					fprintf(stderr,"Numeric argument "
+						"out of range\n");
+					return 0;
+				}
+				return number;
+			default:
+				fprintf(stderr,"Bad syntax of "
+					"numeric argument\n");
+				return 0;
+		}
+	}
+	return number;
+} /* get_number */
+
+
+/**
+ * Get the time duration in ns from argument. It can be number
+ * followed by units: ns|us|ms|s, seconds are the default
+ */
+uint64_t get_duration(char *optarg) {
+	char *endptr;
+	double number;
+
+	errno = 0;
+	number = strtod(optarg, &endptr);
+	if (errno || (endptr == optarg) || (number <= 0)) {
+		fprintf(stderr,"Bad duration %s\n", optarg);
+		return 0;
+	}
+
+	if ((strcmp(endptr, "s") == 0) || (*endptr == '\0'))
+		number *= 1000000000.0;
+	else if (strcmp(endptr, "ms") == 0)
+		number *= 1000000.0;
+	else if (strcmp(endptr, "us") == 0)
+		number *= 1000.0;
+	else if (strcmp(endptr, "ns") != 0) {
+		fprintf(stderr,"Bad duration %s\n", optarg);
+		return 0;
+	}
+
+	if (number < 1.0) {
+		fprintf(stderr,"Bad duration %s\n", optarg);
+		return 0;
+	}
+
+	return (uint64_t)number;
+} /* get_duration */
+
+
+/**
+ * Get the simulated device from the format dist:latency[:depth],
+ * where dist is one of fixed|uniform|exp
+ */
+int get_sim(char *optarg, struct sim_conf *sim) {
+	char buf[64], *lat, *depth;
+
+	strncpy(buf, optarg, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+
+	if ((lat = strchr(buf, ':')) == NULL) {
+		fprintf(stderr,"Simulated device must be dist:latency\n");
+		return 0;
+	}
+	*lat++ = '\0';
+
+	if (strcmp(buf, "fixed") == 0) {
+		sim->dist = OP_SIM_FIXED;
+	} else if (strcmp(buf, "uniform") == 0) {
+		sim->dist = OP_SIM_UNIFORM;
+	} else if (strcmp(buf, "exp") == 0) {
+		sim->dist = OP_SIM_EXP;
+	} else {
+		fprintf(stderr,"Unknown latency distribution %s\n", buf);
+		return 0;
+	}
+
+	sim->depth = 0;
+	if ((depth = strchr(lat, ':')) != NULL) {
+		*depth++ = '\0';
+		sim->depth = atoi(depth);
+		if ((sim->depth < 1) || (sim->depth > MAX_DEPTH)) {
+			fprintf(stderr,"Simulated queue depth must be "
+				"between 1 and %d\n", MAX_DEPTH);
+			return 0;
+		}
+	}
+
+	if ((sim->latency = get_duration(lat)) == 0)
+		return 0;
+
+	return 1;
+} /* get_sim */
+
+
+/**
+ * Get the preconditioning from the format passes[:seq|rand]
+ */
+int get_precondition(char *optarg, struct definitions *defs) {
+	char *endptr;
+
+	errno = 0;
+	defs->precond_passes = strtol(optarg, &endptr, 10);
+	if (errno || (endptr == optarg) || (defs->precond_passes < 1)) {
+		fprintf(stderr,"Bad number of preconditioning passes %s\n",
+			optarg);
+		return 0;
+	}
+
+	if ((*endptr == '\0') || (strcmp(endptr, ":seq") == 0)) {
+		defs->precond_random = 0;
+	} else if (strcmp(endptr, ":rand") == 0) {
+		defs->precond_random = 1;
+	} else {
+		fprintf(stderr,"Preconditioning must be seq or rand\n");
+		return 0;
+	}
+	return 1;
+} /* get_precondition */
+
+
+/**
+ * Get the steady state detection from the format
+ * window[:range[:slope]], range and slope in percent of the mean
+ */
+int get_steady(char *optarg, struct steady *st) {
+	char *endptr;
+
+	st->range = 0.2;
+	st->slope = 0.1;
+
+	errno = 0;
+	st->window = strtol(optarg, &endptr, 10);
+	if (!errno && (*endptr == ':'))
+		st->range = strtod(endptr + 1, &endptr) / 100;
+	if (!errno && (*endptr == ':'))
+		st->slope = strtod(endptr + 1, &endptr) / 100;
+	if (errno || (endptr == optarg) || (*endptr != '\0') ||
+	    (st->window < 2) || (st->window > STEADY_MAX_ROUNDS) ||
+	    (st->range <= 0) || (st->slope <= 0)) {
+		fprintf(stderr,"Bad steady state %s, the window is 2 to %d "
+			"rounds\n", optarg, STEADY_MAX_ROUNDS);
+		return 0;
+	}
+	return 1;
+} /* get_steady */
+
+
+/**
+ * Get the time scale of the replay, a non negative number
+ */
+int get_scale(char *optarg, double *scale) {
+	char *endptr;
+
+	errno = 0;
+	*scale = strtod(optarg, &endptr);
+	if (errno || (endptr == optarg) || (*endptr != '\0') ||
+	    (*scale < 0)) {
+		fprintf(stderr,"Bad replay time scale %s\n", optarg);
+		return 0;
+	}
+	return 1;
+} /* get_scale */
+
+
+/**
+ * Get the random IO pattern from the format name[:args], which is
+ * uniform, strided:stride, zipf[:theta] or varlen:uniform|exp:mean
+ */
+int get_pattern(char *optarg, struct pattern_conf *conf) {
+	char *opt, *endptr;
+
+	memset(conf, 0, sizeof(*conf));
+
+	if (strcmp(optarg, "uniform") == 0) {
+		conf->type = PATTERN_UNIFORM;
+		return 1;
+	}
+
+	if (strncmp(optarg, "strided:", 8) == 0) {
+		conf->type = PATTERN_STRIDED;
+		opt = optarg + 8;
+		return (conf->bytes = get_number(&opt)) != 0;
+	}
+
+	if (strncmp(optarg, "zipf", 4) == 0) {
+		conf->type = PATTERN_ZIPF;
+		conf->theta = 0.99;
+		if (optarg[4] == '\0')
+			return 1;
+		errno = 0;
+		if (optarg[4] == ':')
+			conf->theta = strtod(optarg + 5, &endptr);
+		if ((optarg[4] != ':') || errno || (*endptr != '\0') ||
+		    (conf->theta <= 0) || (conf->theta >= 1)) {
+			fprintf(stderr,"Zipf theta must be between 0 and 1\n");
+			return 0;
+		}
+		return 1;
+	}
+
+	if (strncmp(optarg, "varlen:", 7) == 0) {
+		conf->type = PATTERN_VARLEN;
+		opt = optarg + 7;
+		if (strncmp(opt, "uniform:", 8) == 0) {
+			conf->dist = VARLEN_UNIFORM;
+			opt += 8;
+		} else if (strncmp(opt, "exp:", 4) == 0) {
+			conf->dist = VARLEN_EXP;
+			opt += 4;
+		} else {
+			fprintf(stderr,"Extent length must be uniform or exp\n");
+			return 0;
+		}
+		return (conf->bytes = get_number(&opt)) != 0;
+	}
+
+	fprintf(stderr,"Unknown pattern %s\n", optarg);
+	return 0;
+} /* get_pattern */
+
+
+/**
+ * Get the record ranges from the format start:end:step
+ */
+int get_range(char *optarg,struct records *rec) {
+	char *opt;
+
+	opt = optarg;
+
+	if ((rec->start = get_number(&opt)) == 0) {
+		return 0;
+	}
+	if ((rec->end = get_number(&opt)) == 0) {
+		return 0;
+	}
+	if ((rec->step = get_number(&opt)) == 0) {
+		return 0;
+	}
+
+	if ((rec->start > rec->end) || 
+	   ((rec->start + rec->step) > rec->end) ||
+	   (rec->step == 0))
+	{
+		fprintf(stderr,"Insane record range: %llu:%llu:%llu\n",
+			rec->start,rec->end,rec->step);
+		return 0;
+	}
+
+	return 1;
+} /* get_range */
+
+
+/**
+ * Determine device size to avoid issuing discard command
+ * out of the device size.
+ */
+unsigned long long
+get_device_size(const int fd) {
+	uint64_t nblocks;
+
+/*
+ *BLKBSZGET - logical block size
+ *BLKSSZGET - hw block size
+ *BLKGETSIZE - return device size /512 (long *arg) 
+ *BLKGETSIZE64 - return device size in bytes (u64 *arg) 
+ * */
+
+	if (ioctl(fd, BLKGETSIZE64,&nblocks) == -1) {
+		perror("Ioctl block device");
+		return 0;
+	}
+
+	return (unsigned long long)nblocks;
+} /* get_device_size */
+
+
+/**
+ * Determine device sector size
+ */
+int get_sector_size(const int fd) {
+	int ssize;
+
+	if (ioctl(fd, BLKSSZGET, &ssize) == -1) {
+		perror("Ioctl block device");
+		return 0;
+	}
+
+	return ssize;
+} /* get sector size */
+
+
+/**
+ * Read a number from the sysfs attribute of the block device.
+ * Partitions do not have the queue directory, it belongs to the
+ * whole disk one level up.
+ */
+int read_sysfs(
+	struct stat *sb,
+	const char *name,
+	unsigned long long *value)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%s",
+		 major(sb->st_rdev), minor(sb->st_rdev), name);
+	if ((f = fopen(path, "r")) == NULL) {
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../%s",
+			 major(sb->st_rdev), minor(sb->st_rdev), name);
+		if ((f = fopen(path, "r")) == NULL)
+			return -1;
+	}
+
+	ret = fscanf(f, "%llu", value);
+	fclose(f);
+
+	return (ret == 1) ? 0 : -1;
+} /* read_sysfs */
+
+
+/**
+ * Read the counters of the block device, valid is zero when
+ * the kernel is older than 4.18 and does not count discards
+ */
+void get_blk_stat(dev_t dev, struct blk_stat *blk) {
+	unsigned long long f[15];
+	char path[PATH_MAX];
+	FILE *file;
+	int ret;
+
+	memset(blk, 0, sizeof(*blk));
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/stat",
+		 major(dev), minor(dev));
+	if ((file = fopen(path, "r")) == NULL)
+		return;
+
+	ret = fscanf(file, "%llu %llu %llu %llu %llu %llu %llu %llu "
+		     "%llu %llu %llu %llu %llu %llu %llu",
+		     &f[0], &f[1], &f[2], &f[3], &f[4], &f[5], &f[6], &f[7],
+		     &f[8], &f[9], &f[10], &f[11], &f[12], &f[13], &f[14]);
+	fclose(file);
+	if (ret != 15)
+		return;
+
+	blk->valid = 1;
+	blk->inflight = f[8];
+	blk->io_ticks = f[9];
+	blk->discards = f[11];
+	blk->merges = f[12];
+	blk->sectors = f[13];
+	blk->ticks = f[14];
+} /* get_blk_stat */
+
+
+/**
+ * Difference of the counters read after and before the step,
+ * inflight is the number of requests left in flight at the end
+ */
+void diff_blk_stat(
+	struct blk_stat *res,
+	struct blk_stat *before,
+	struct blk_stat *after)
+{
+	res->valid = before->valid && after->valid;
+	res->discards = after->discards - before->discards;
+	res->merges = after->merges - before->merges;
+	res->sectors = after->sectors - before->sectors;
+	res->ticks = after->ticks - before->ticks;
+	res->io_ticks = after->io_ticks - before->io_ticks;
+	res->inflight = after->inflight;
+} /* diff_blk_stat */
+
+
+/**
+ * Get discard limits of the device, whatever of them the kernel
+ * exports. Missing ones are left zero.
+ */
+void get_discard_limits(const int fd, struct discard_limits *limits) {
+	struct stat sb;
+
+	memset(limits, 0, sizeof(*limits));
+
+	if ((fstat(fd, &sb) == -1) || !S_ISBLK(sb.st_mode))
+		return;
+
+	read_sysfs(&sb, "queue/discard_granularity", &limits->granularity);
+	read_sysfs(&sb, "discard_alignment", &limits->alignment);
+	read_sysfs(&sb, "queue/discard_max_bytes", &limits->max_bytes);
+	read_sysfs(&sb, "queue/discard_max_hw_bytes", &limits->max_hw_bytes);
+	read_sysfs(&sb, "queue/discard_zeroes_data", &limits->zeroes_data);
+} /* get_discard_limits */
+
+
+/**
+ * Get some random data to put on the device
+ */
+int get_entropy(char *entropy, int size) {
+	int ent_fd;
+	ssize_t ret;
+	
+	if ((ent_fd = open("/dev/urandom",O_RDONLY)) == -1) {
+		perror("Opening urandom device");
+		return -1;
+	}
+
+	/* urandom may return less than asked for big buffers */
+	while (size > 0) {
+		if ((ret = read(ent_fd,entropy,size)) <= 0) {
+			perror("Reading urandom device");
+			close(ent_fd);
+			return -1;
+		}
+		entropy += ret;
+		size -= ret;
+	}
+	close(ent_fd);
+
+	return 0;
+} /* get_entropy */
+
+
+/**
+ * Take the next chunk of at most prep_buf bytes to write.
+ * Returns 0 when there is nothing left to write.
+ */
+int prep_next_chunk(struct prep_job *job, uint64_t *start, uint64_t *size) {
+	struct prep_run *run;
+	int ret = 0;
+
+	pthread_mutex_lock(&job->lock);
+	while (!job->err && (job->next_run < job->nruns)) {
+		run = &job->runs[job->next_run];
+
+		if (job->next_offset >= run->size) {
+			job->next_run++;
+			job->next_offset = 0;
+			continue;
+		}
+
+		*start = run->start + job->next_offset;
+		*size = run->size - job->next_offset;
+		if (*size > job->defs->prep_buf)
+			*size = job->defs->prep_buf;
+		job->next_offset += *size;
+		ret = 1;
+		break;
+	}
+	pthread_mutex_unlock(&job->lock);
+
+	return ret;
+} /* prep_next_chunk */
+
+
+/**
+ * Prep writer thread. It writes chunks from its own aligned buffer
+ * of pseudorandom data through its own O_DIRECT file descriptor, so
+ * the page cache is bypassed and several writes are in flight.
+ */
+void *prep_thread(void *arg) {
+	struct prep_job *job = (struct prep_job *)arg;
+	struct definitions *defs = job->defs;
+	uint64_t start, size, done;
+	ssize_t ret;
+	char *buf;
+	int fd;
+
+	if ((fd = open(defs->target, O_RDWR | O_DIRECT)) == -1) {
+		/* not every device supports direct IO */
+		if ((errno != EINVAL) ||
+		    ((fd = open(defs->target, O_RDWR)) == -1)) {
+			perror("Opening block device");
+			goto err;
+		}
+	}
+
+	if ((errno = posix_memalign((void **)&buf, PREP_ALIGN,
+	     defs->prep_buf)) != 0) {
+		perror("posix_memalign");
+		close(fd);
+		goto err;
+	}
+
+	if (get_entropy(buf, defs->prep_buf) == -1) {
+		fprintf(stderr,"Error while gathering entropy\n");
+		goto err_free;
+	}
+
+	while (prep_next_chunk(job, &start, &size)) {
+		for (done = 0; done < size; done += ret) {
+			ret = pwrite(fd, buf + done, size - done,
+				     start + done);
+			if (ret == -1) {
+				perror("prep write");
+				goto err_free;
+			}
+			if (ret == 0) {
+				fprintf(stderr,"prep write: Written size "
+					"is smaller than expected\n");
+				goto err_free;
+			}
+		}
+	}
+
+	if (fsync(fd) == -1) {
+		perror("prep fsync");
+		goto err_free;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+
+err_free:
+	free(buf);
+	close(fd);
+err:
+	pthread_mutex_lock(&job->lock);
+	job->err = 1;
+	pthread_mutex_unlock(&job->lock);
+	return NULL;
+} /* prep_thread */
+
+
+/**
+ * Write pseudorandom data to all the runs with prep_depth
+ * writers and report the throughput of preparation
+ */
+int prep_write(
+	struct definitions *defs,
+	struct prep_run *runs,
+	unsigned long nruns)
+{
+	pthread_t threads[MAX_THREADS];
+	struct prep_job job;
+	uint64_t time_start, time, bytes = 0;
+	unsigned long i;
+	int started;
+
+	for (i = 0; i < nruns; i++)
+		bytes += runs[i].size;
+
+	job.defs = defs;
+	job.runs = runs;
+	job.nruns = nruns;
+	job.next_run = 0;
+	job.next_offset = 0;
+	job.err = 0;
+	pthread_mutex_init(&job.lock, NULL);
+
+	time_start = timer_now();
+
+	for (started = 0; started < defs->prep_depth; started++) {
+		if ((errno = pthread_create(&threads[started], NULL,
+		     prep_thread, &job)) != 0) {
+			perror("pthread_create");
+			job.err = 1;
+			break;
+		}
+	}
+
+	for (i = 0; i < (unsigned long)started; i++)
+		pthread_join(threads[i], NULL);
+
+	time = timer_ns(timer_now() - time_start);
+	pthread_mutex_destroy(&job.lock);
+
+	if (job.err)
+		return -1;
+
+	if (IS_HUMAN(defs->flags)) {
+		fprintf(stdout,"Prepared %llu bytes in %lfs (%lf MB/s)\n",
+			(unsigned long long)bytes, NS_TO_S(time),
+			(bytes / (1024.0 * 1024.0)) / NS_TO_S(time));
+	} else {
+		fprintf(stdout,"# prepared %llu bytes in %lf s %lf MB/s\n",
+			(unsigned long long)bytes, NS_TO_S(time),
+			(bytes / (1024.0 * 1024.0)) / NS_TO_S(time));
+	}
+
+	return 0;
+} /* prep_write */
+
+
+/**
+ * Write some data to the device in order to prevent
+ * discarding already discarded blocks
+ */
+int prepare_device (struct definitions *defs) {
+	struct prep_run run;
+
+	if (IS_RANDOMIO(defs->flags)) {
+		defs->start = 0;
+		run.start = defs->win_start;
+		run.size = defs->win_size;
+	} else {
+		run.start = defs->start;
+		run.size = defs->total_size;
+	}
+
+	if (IS_NOPREPARE(defs->flags))
+		return 0;
+	return prep_write(defs, &run, 1);
+} /* prepare_device */
+
+
+/**
+ * Write the part of the device the replayed trace discards
+ */
+int prepare_replay(struct definitions *defs) {
+	struct prep_run run;
+
+	run.start = defs->replay->start;
+	run.size = defs->replay->end - defs->replay->start;
+
+	if (IS_NOPREPARE(defs->flags))
+		return 0;
+	return prep_write(defs, &run, 1);
+} /* prepare_replay */
+
+
+/**
+ * Precondition the device by writing all of it (the working set with
+ * [-W]) precond_passes times, sequentially or in random order of
+ * prep_buf chunks, so the test does not start with a fresh drive
+ */
+int precondition_device(struct definitions *defs) {
+	struct prep_run *runs, tmp;
+	unsigned long nruns, i, j;
+	struct prng rng;
+	int pass;
+
+	nruns = (defs->win_size + defs->prep_buf - 1) / defs->prep_buf;
+	if (!defs->precond_random)
+		nruns = 1;
+
+	if ((runs = malloc(nruns * sizeof(struct prep_run))) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	if (defs->precond_random) {
+		for (i = 0; i < nruns; i++) {
+			runs[i].start = defs->win_start + i * defs->prep_buf;
+			runs[i].size = defs->prep_buf;
+		}
+		runs[nruns - 1].size = defs->win_start + defs->win_size -
+				       runs[nruns - 1].start;
+		prng_seed(&rng, defs->seed + defs->worker + 2);
+	} else {
+		runs[0].start = defs->win_start;
+		runs[0].size = defs->win_size;
+	}
+
+	for (pass = 0; (pass < defs->precond_passes) && !stop; pass++) {
+		if (IS_HUMAN(defs->flags))
+			fprintf(stdout,"[+] Preconditioning %s, pass %d "
+				"of %d\n", defs->target, pass + 1,
+				defs->precond_passes);
+
+		/* new order for every pass */
+		for (i = nruns - 1; defs->precond_random && (i > 0); i--) {
+			j = prng_bounded(&rng, i + 1);
+			tmp = runs[i];
+			runs[i] = runs[j];
+			runs[j] = tmp;
+		}
+
+		if (prep_write(defs, runs, nruns) == -1) {
+			free(runs);
+			return -1;
+		}
+	}
+
+	free(runs);
+	return 0;
+} /* precondition_device */
+
+
+/**
+ * Compare prep runs by their start
+ */
+int cmp_runs(const void *a, const void *b) {
+	const struct prep_run *x = a, *y = b;
+
+	return (x->start > y->start) - (x->start < y->start);
+} /* cmp_runs */
+
+
+/**
+ * Overwrite only discarded blocks.
+ * Instead of overwriting whole disk with random
+ * data in order to prevent discarding already discarded
+ * blocks, simply overwrite only data discarded in 
+ * previous step - this information is stored in the 
+ * tracker. Close extents are merged into one run
+ * and the runs are written by the prep writers in parallel.
+ */
+int prepare_by_tree(struct definitions *defs) {
+	struct tracker_iter it;
+	struct extent entry;
+	struct prep_run *runs = NULL, *run, *tmp;
+	unsigned long nruns = 0, size = 0, i;
+	uint64_t start, total;
+	int ret, sorted = 1;
+
+	tracker_iter_init(defs->tracker, &it);
+	while ((ret = tracker_iter_next(defs->tracker, &it, &entry)) != 0) {
+
+		if (ret == -1) {
+			free(runs);
+			crit_err(defs);
+		}
+
+		total = (entry.count * defs->record_size);
+		start = defs->win_start + entry.start * defs->record_size;
+		if (start + total > defs->win_start + defs->win_size)
+			total = defs->win_start + defs->win_size - start;
+
+		if (nruns == size) {
+			size = size ? size * 2 : 1024;
+			if ((tmp = realloc(runs, size * sizeof(*runs))) == NULL) {
+				perror("realloc");
+				free(runs);
+				return -1;
+			}
+			runs = tmp;
+		}
+
+		if (nruns && (start < runs[nruns - 1].start))
+			sorted = 0;
+
+		runs[nruns].start = start;
+		runs[nruns].size = total;
+		nruns++;
+	}
+
+	/* perm tracker returns blocks in the order they were picked */
+	if (!sorted)
+		qsort(runs, nruns, sizeof(*runs), cmp_runs);
+
+	/*
+	 * Merge the run with the previous one if rewriting the gap
+	 * between them is cheaper than issuing another write
+	 */
+	for (i = 1, run = runs; i < nruns; i++) {
+		if (runs[i].start - (run->start + run->size) <= defs->prep_gap) {
+			run->size = runs[i].start + runs[i].size - run->start;
+			continue;
+		}
+		*(++run) = runs[i];
+	}
+	if (nruns)
+		nruns = run - runs + 1;
+
+	ret = 0;
+	if (nruns && !IS_NOPREPARE(defs->flags))
+		ret = prep_write(defs, runs, nruns);
+	free(runs);
+
+	return ret;
+} /* prepare_by_tree */
+
+
+/**
+ * Record size used for the given size of the sweep. With [--align]
+ * it is rounded up to the multiple of the discard granularity.
+ */
+unsigned long long step_record(
+	struct definitions *defs,
+	unsigned long long size)
+{
+	unsigned long long gran = defs->limits.granularity;
+
+	if (!IS_AUTOALIGN(defs->flags) || (gran == 0))
+		return size;
+
+	return (size + gran - 1) / gran * gran;
+} /* step_record */
+
+
+/**
+ * Total size of the step with given record size. It is the requested
+ * total size rounded to the multiple of the record size, which still
+ * fits in the device.
+ */
+unsigned long long step_size(
+	struct definitions *defs,
+	struct plan *plan,
+	unsigned long long record_size)
+{
+	unsigned long long size;
+
+	size = (unsigned long long)
+		((plan->total / (double)record_size) + 0.5);
+	size *= record_size;
+
+	if ((plan->base + size) > defs->dev_size) {
+		size = (defs->dev_size - plan->base) / record_size;
+		size *= record_size;
+	}
+
+	return size;
+} /* step_size */
+
+
+/**
+ * Offset of the first record at or after pos. Records are placed at
+ * the same alignment to the record size as if the step started at the
+ * beginning of the tested region.
+ */
+unsigned long long plan_align(
+	struct plan *plan,
+	unsigned long long pos,
+	unsigned long long record_size)
+{
+	unsigned long long off = pos - plan->base;
+
+	off = (off + record_size - 1) / record_size * record_size;
+
+	return plan->base + off;
+} /* plan_align */
+
+
+/**
+ * Place the step into the prepared space which was not discarded yet.
+ * When there is not enough of it, lay out as many following steps as
+ * fit into the rest of the device and prepare all of them in one
+ * sequential pass. After the whole device was used we start over from
+ * the beginning of the tested region.
+ */
+int plan_step(
+	struct definitions *defs,
+	struct plan *plan,
+	unsigned long long *sizes,
+	unsigned nsizes)
+{
+	struct prep_run run;
+	unsigned long long start, end, size, record_size;
+	unsigned i;
+
+	start = plan_align(plan, plan->next, defs->record_size);
+	if ((start + defs->total_size) <= plan->end) {
+		defs->start = start;
+		plan->next = start + defs->total_size;
+		return 0;
+	}
+
+	if ((start + defs->total_size) > defs->dev_size)
+		start = plan->base;
+	end = start + defs->total_size;
+
+	for (i = 0; i < nsizes; i++) {
+		record_size = step_record(defs, sizes[i]);
+		size = step_size(defs, plan, record_size);
+		if ((plan_align(plan, end, record_size) + size) >
+		    defs->dev_size)
+			break;
+		end = plan_align(plan, end, record_size) + size;
+	}
+
+	if (IS_HUMAN(defs->flags) && !IS_NOPREPARE(defs->flags)) {
+		fprintf(stdout,"[+] Preparing device for %u steps\n",
+			i + 1);
+	}
+
+	defs->start = start;
+	plan->next = start + defs->total_size;
+	plan->end = end;
+
+	run.start = start;
+	run.size = end - start;
+	if (IS_NOPREPARE(defs->flags))
+		return 0;
+	return prep_write(defs, &run, 1);
+} /* plan_step */
+
+
+/**
+ * Append the record size to the sweep
+ */
+int sweep_add(struct sweep *sw, unsigned long long size) {
+	unsigned long long *sizes;
+	double *tput;
+	unsigned cap;
+
+	if (sw->n == sw->cap) {
+		cap = sw->cap ? sw->cap * 2 : 64;
+		sizes = realloc(sw->sizes, cap * sizeof(*sizes));
+		if (sizes == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		sw->sizes = sizes;
+		tput = realloc(sw->tput, cap * sizeof(*tput));
+		if (tput == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		sw->tput = tput;
+		sw->cap = cap;
+	}
+
+	sw->tput[sw->n] = 0;
+	sw->sizes[sw->n++] = size;
+
+	return 0;
+} /* sweep_add */
+
+
+/**
+ * Plan the record sizes of the sweep. Linear sweep tests every step
+ * of the range, adaptive one starts with the powers of two multiples
+ * of the range start and the end of the range.
+ */
+int sweep_init(
+	struct sweep *sw,
+	struct records *rec,
+	unsigned long long record_size)
+{
+	unsigned long long size;
+
+	sw->sizes = NULL;
+	sw->tput = NULL;
+	sw->n = sw->cap = 0;
+
+	if (rec->step == 0)
+		return sweep_add(sw, record_size);
+
+	if (sw->threshold == 0) {
+		for (size = rec->start; size <= rec->end; size += rec->step)
+			if (sweep_add(sw, size) == -1)
+				return -1;
+		return 0;
+	}
+
+	for (size = rec->start; size < rec->end; size *= 2)
+		if (sweep_add(sw, size) == -1)
+			return -1;
+
+	return sweep_add(sw, rec->end);
+} /* sweep_init */
+
+
+/**
+ * Add record sizes at the discard limits of the device and one range
+ * step around them to the sweep, unless they are there already
+ */
+int sweep_centre(
+	struct sweep *sw,
+	struct records *rec,
+	struct discard_limits *l)
+{
+	unsigned long long bounds[3], sizes[3];
+	unsigned i, j, k;
+
+	if (rec->step == 0)
+		return 0;
+
+	bounds[0] = l->granularity;
+	bounds[1] = l->max_bytes;
+	bounds[2] = l->max_hw_bytes;
+
+	for (i = 0; i < 3; i++) {
+		sizes[0] = bounds[i] - rec->step;
+		sizes[1] = bounds[i];
+		sizes[2] = bounds[i] + rec->step;
+
+		for (j = 0; j < 3; j++) {
+			if ((bounds[i] <= rec->step) && (j == 0))
+				continue;
+			if ((sizes[j] < rec->start) || (sizes[j] > rec->end))
+				continue;
+
+			for (k = 0; k < sw->n; k++)
+				if (sw->sizes[k] == sizes[j])
+					break;
+			if ((k == sw->n) && (sweep_add(sw, sizes[j]) == -1))
+				return -1;
+		}
+	}
+
+	return 0;
+} /* sweep_centre */
+
+
+int cmp_points(const void *a, const void *b) {
+	const struct sweep_point *pa = a, *pb = b;
+
+	if (pa->size < pb->size)
+		return -1;
+	return pa->size > pb->size;
+} /* cmp_points */
+
+
+/**
+ * Add record sizes in the middle of the neighbouring tested sizes whose
+ * throughput differs by more than the threshold, so the steps are
+ * spent around the knees of the curve. Sizes are kept multiples of the
+ * range step away from the range start, so it is also the finest
+ * resolution of the sweep. Return number of added sizes or -1.
+ */
+int sweep_refine(struct sweep *sw, struct records *rec) {
+	struct sweep_point *points;
+	unsigned long long mid;
+	unsigned i, n = sw->n;
+	double diff, max;
+	int added = 0;
+
+	if ((sw->threshold == 0) || (n < 2))
+		return 0;
+
+	if ((points = malloc(n * sizeof(*points))) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		points[i].size = sw->sizes[i];
+		points[i].tput = sw->tput[i];
+	}
+	qsort(points, n, sizeof(*points), cmp_points);
+
+	for (i = 1; i < n; i++) {
+		diff = points[i].tput - points[i - 1].tput;
+		if (diff < 0)
+			diff = -diff;
+		max = points[i].tput > points[i - 1].tput ?
+		      points[i].tput : points[i - 1].tput;
+		if ((max == 0) || (diff / max <= sw->threshold))
+			continue;
+
+		mid = (points[i - 1].size + points[i].size) / 2;
+		mid = rec->start + (mid - rec->start) / rec->step * rec->step;
+		if (mid <= points[i - 1].size)
+			continue;
+
+		if (sweep_add(sw, mid) == -1) {
+			added = -1;
+			break;
+		}
+		added++;
+	}
+
+	free(points);
+	return added;
+} /* sweep_refine */
+
+
+/**
+ * Parse the foreground job from the format rw:bs[:depth[:start:size]]
+ */
+int get_fg_job(char *optarg, struct fg_job *job) {
+	char *opt, *endptr;
+
+	memset(job, 0, sizeof(*job));
+	job->depth = 1;
+	job->fd = -1;
+
+	if (strncmp(optarg, "read:", 5) == 0) {
+		opt = optarg + 5;
+	} else if (strncmp(optarg, "write:", 6) == 0) {
+		job->write = 1;
+		opt = optarg + 6;
+	} else {
+		fprintf(stderr,"Foreground job must start with read: "
+			"or write:\n");
+		return 0;
+	}
+
+	/* get_number() moves opt only behind the delimiter */
+	endptr = opt;
+	if ((job->block_size = get_number(&opt)) == 0)
+		return 0;
+	if (opt == endptr)
+		return 1;
+
+	errno = 0;
+	job->depth = strtol(opt, &endptr, 10);
+	if (errno || (job->depth < 1) || (job->depth > MAX_DEPTH)) {
+		fprintf(stderr,"Foreground queue depth must be between "
+			"1 and %d\n", MAX_DEPTH);
+		return 0;
+	}
+	if (*endptr == '\0')
+		return 1;
+	if (*endptr != ':') {
+		fprintf(stderr,"Bad syntax of foreground job %s\n", optarg);
+		return 0;
+	}
+	opt = endptr + 1;
+
+	endptr = opt;
+	if (strncmp(opt, "0:", 2) == 0)
+		opt += 2;
+	else if ((job->start = get_number(&opt)) == 0)
+		return 0;
+	if (opt == endptr) {
+		fprintf(stderr,"Foreground region must be start:size\n");
+		return 0;
+	}
+	if ((job->size = get_number(&opt)) == 0)
+		return 0;
+
+	return 1;
+} /* get_fg_job */
+
+
+/**
+ * Check the foreground job against the device, the rest of the
+ * device after start is used when the size is not given
+ */
+int check_fg_job(struct definitions *defs, struct fg_job *job) {
+
+	if ((job->block_size % defs->dev_ssize) ||
+	    (job->start % defs->dev_ssize)) {
+		fprintf(stderr,"Foreground job must be aligned to the "
+			"sector size\n");
+		return -1;
+	}
+
+	if (job->start >= defs->dev_size) {
+		fprintf(stderr,"Foreground job does not fit in the device\n");
+		return -1;
+	}
+	if (job->size == 0)
+		job->size = defs->dev_size - job->start;
+
+	if ((job->start + job->size > defs->dev_size) ||
+	    (job->size < job->block_size)) {
+		fprintf(stderr,"Foreground job does not fit in the device\n");
+		return -1;
+	}
+
+	return 0;
+} /* check_fg_job */
+
+
+/**
+ * Foreground job thread entry point. Keeps job->depth reads or
+ * writes of random blocks of the region in flight through io_uring
+ * until it is asked to stop.
+ */
+void *fg_thread(void *arg) {
+	struct fg_job *job = (struct fg_job *)arg;
+	struct uring ring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	uint64_t *submitted, nblocks, now;
+	unsigned inflight = 0, slot, *free_slots, nfree;
+	int done = 0;
+
+	if (uring_init(&ring, job->depth) == -1) {
+		perror("io_uring_setup");
+		job->err = 1;
+		return NULL;
+	}
+
+	submitted = malloc(sizeof(uint64_t) * job->depth);
+	free_slots = malloc(sizeof(unsigned) * job->depth);
+	if (!submitted || !free_slots) {
+		perror("malloc");
+		job->err = 1;
+		goto out;
+	}
+	for (nfree = 0; nfree < (unsigned)job->depth; nfree++)
+		free_slots[nfree] = nfree;
+
+	nblocks = job->size / job->block_size;
+
+	while (!done || inflight) {
+
+		done = __atomic_load_n(&job->done, __ATOMIC_RELAXED);
+
+		while (!done && nfree) {
+			if ((sqe = uring_get_sqe(&ring)) == NULL)
+				break;
+
+			slot = free_slots[--nfree];
+			sqe->opcode = job->write ? IORING_OP_WRITE :
+						   IORING_OP_READ;
+			sqe->fd = job->fd;
+			sqe->addr = (uintptr_t)(job->buf +
+						slot * job->block_size);
+			sqe->len = job->block_size;
+			sqe->off = job->start + job->block_size *
+				   prng_bounded(&job->rng, nblocks);
+			sqe->user_data = slot;
+
+			submitted[slot] = timer_now();
+			inflight++;
+		}
+
+		if (!inflight)
+			break;
+
+		if (uring_submit(&ring, 1) == -1) {
+			perror("io_uring_enter");
+			job->err = 1;
+			break;
+		}
+
+		while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+
+			now = timer_now();
+			slot = cqe->user_data;
+			if (cqe->res < 0) {
+				fprintf(stderr, "Foreground %s: %s\n",
+					job->write ? "write" : "read",
+					strerror(-cqe->res));
+				job->err = 1;
+				done = 1;
+				__atomic_store_n(&job->done, 1,
+						 __ATOMIC_RELAXED);
+			} else {
+				add_sample(job->stats,
+					   timer_sample(submitted[slot], now));
+				job->stats->bytes += cqe->res;
+			}
+
+			uring_cqe_seen(&ring);
+			free_slots[nfree++] = slot;
+			inflight--;
+		}
+	}
+
+out:
+	free(submitted);
+	free(free_slots);
+	uring_exit(&ring);
+	return NULL;
+} /* fg_thread */
+
+
+/**
+ * Stop all foreground jobs and wait for them
+ */
+int stop_fg(struct definitions *defs) {
+	int i, err = 0;
+
+	for (i = 0; i < defs->nfg; i++)
+		__atomic_store_n(&defs->fg[i].done, 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < defs->nfg; i++) {
+		pthread_join(defs->fg[i].thread, NULL);
+		if (defs->fg[i].err)
+			err = -1;
+	}
+
+	return err;
+} /* stop_fg */
+
+
+/**
+ * Start all foreground jobs measuring into the given phase
+ */
+int start_fg(struct definitions *defs, int discard) {
+	struct fg_job *job;
+	int i;
+
+	for (i = 0; i < defs->nfg; i++) {
+		job = &defs->fg[i];
+		job->stats = discard ? &job->on : &job->off;
+		init_stats(job->stats);
+		job->done = 0;
+		job->err = 0;
+
+		if ((errno = pthread_create(&job->thread, NULL,
+		     fg_thread, job)) != 0) {
+			perror("pthread_create");
+			defs->nfg = i;
+			stop_fg(defs);
+			return -1;
+		}
+	}
+
+	return 0;
+} /* start_fg */
+
+
+/**
+ * Open the device for the foreground jobs and fill their buffers
+ */
+int open_fg(struct definitions *defs) {
+	struct fg_job *job;
+	size_t size;
+	int i;
+
+	for (i = 0; i < defs->nfg; i++) {
+		job = &defs->fg[i];
+
+		if ((job->fd = open(defs->target, O_RDWR | O_DIRECT)) == -1) {
+			perror("Opening block device with O_DIRECT");
+			return -1;
+		}
+
+		size = job->block_size * job->depth;
+		if ((errno = posix_memalign((void **)&job->buf,
+		     PREP_ALIGN, size)) != 0) {
+			perror("posix_memalign");
+			return -1;
+		}
+		if (get_entropy(job->buf, size) == -1)
+			return -1;
+
+		prng_seed(&job->rng, defs->seed + i + 1);
+	}
+
+	return 0;
+} /* open_fg */
+
+
+/**
+ * Close what open_fg() opened
+ */
+void close_fg(struct definitions *defs) {
+	int i;
+
+	for (i = 0; i < defs->nfg; i++) {
+		if (defs->fg[i].fd != -1)
+			close(defs->fg[i].fd);
+		free(defs->fg[i].buf);
+	}
+} /* close_fg */
+
+
+/**
+ * Run the foreground jobs alone for the given time in ns
+ */
+int run_fg_alone(struct definitions *defs, uint64_t time) {
+	struct timespec ts;
+
+	if (start_fg(defs, 0) == -1)
+		return -1;
+
+	ts.tv_sec = time / 1000000000ULL;
+	ts.tv_nsec = time % 1000000000ULL;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+
+	return stop_fg(defs);
+} /* run_fg_alone */
+
+
+/**
+ * Compute throughput in MB/s. When more discards are in flight at the
+ * same time the sum of ioctl durations is bigger than the time it took
+ * to discard the data, so the wall clock time is used instead.
+ */
+double get_throughput(
+	struct definitions *defs,
+	struct statistics *stats
+	)
+{
+	uint64_t time = stats->sum;
+
+	/* open loop latencies include the wait for the late schedule */
+	if ((defs->threads > 1) || (defs->depth > 1) || defs->rate ||
+	    defs->replay)
+		time = stats->elapsed;
+
+	return (stats->bytes / (1024.0 * 1024.0)) / NS_TO_S(time);
+} /* get_throughput */
+
+
+/**
+ * Print what the kernel saw of the step next to our statistics.
+ * More kernel discards than ours mean our records were split, less
+ * of them per op than one with merges mean they were merged.
+ */
+void print_blk_stat(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	struct blk_stat *blk = &stats->blk;
+	double avg = 0, ratio = 0, busy;
+
+	if (blk->discards) {
+		avg = blk->sectors * 512.0 / blk->discards;
+		ratio = (double)blk->merges / (blk->discards + blk->merges);
+	}
+	busy = blk->io_ticks / 1000.0;
+
+	if (IS_HUMAN(defs->flags)) {
+		fprintf(stdout,"kernel discards = %llu (%lf per op)\n"
+			"kernel avg size = %.0lf\n"
+			"kernel merges = %llu (ratio %lf)\n"
+			"kernel discard time = %.3lfs\n"
+			"device busy = %.3lfs (%.1lf%%)\n"
+			"inflight at the end = %llu\n",
+			blk->discards, stats->count ?
+			(double)blk->discards / stats->count : 0, avg,
+			blk->merges, ratio, blk->ticks / 1000.0, busy,
+			stats->elapsed ? 100.0 * busy / NS_TO_S(stats->elapsed)
+			: 0, blk->inflight);
+	} else {
+		fprintf(stdout," %llu %.0lf %lf %.3lf %.3lf",
+			blk->discards, avg, ratio, blk->ticks / 1000.0, busy);
+	}
+} /* print_blk_stat */
+
+
+/**
+ * Print the CPU cost of the step per operation, to see how much of
+ * the step time is spent in the host rather than in the device
+ */
+void print_perf(
+	struct definitions *defs,
+	struct statistics *stats)
+{
+	double ops = stats->count ? stats->count : 1;
+	int i;
+
+	if (IS_HUMAN(defs->flags)) {
+		for (i = 0; i < PERF_NR; i++) {
+			if (stats->perf.valid & (1 << i))
+				fprintf(stdout,"%s = %llu (%lf per op)\n",
+					perf_names[i],
+					(unsigned long long)stats->perf.val[i],
+					stats->perf.val[i] / ops);
+			else
+				fprintf(stdout,"%s = not available\n",
+					perf_names[i]);
+		}
+		fprintf(stdout,"user time = %.6lfs (%.3lf us per op)\n"
+			"sys time = %.6lfs (%.3lf us per op)\n"
+			"cpu share = %.1lf%% of discard time\n",
+			stats->utime, stats->utime * 1000000 / ops,
+			stats->stime, stats->stime * 1000000 / ops,
+			stats->sum ? 100 * (stats->utime + stats->stime) /
+			NS_TO_S(stats->sum) : 0);
+	} else {
+		/* -1 if the counter is not available */
+		for (i = 0; i < PERF_NR; i++)
+			fprintf(stdout," %lf", (stats->perf.valid & (1 << i)) ?
+				stats->perf.val[i] / ops : -1.0);
+		fprintf(stdout," %.3lf %.3lf", stats->utime * 1000000 / ops,
+			stats->stime * 1000000 / ops);
+	}
+} /* print_perf */
+
+
+/**
+ * Print foreground job results of one phase
+ */
+void print_fg_phase(
+	struct definitions *defs,
+	struct fg_job *job,
+	struct statistics *stats,
+	const char *phase)
+{
+	double mbs = 0;
+
+	if (stats->elapsed)
+		mbs = (stats->bytes / (1024.0 * 1024.0)) /
+		      NS_TO_S(stats->elapsed);
+
+	if (IS_HUMAN(defs->flags)) {
+		fprintf(stdout,"  discard %s: count = %lu, %lf MB/s, "
+			"p50 = %.9lfs, p99 = %.9lfs, p99.9 = %.9lfs\n",
+			phase, stats->count, mbs,
+			NS_TO_S(hist_percentile(&stats->hist, 50)),
+			NS_TO_S(hist_percentile(&stats->hist, 99)),
+			NS_TO_S(hist_percentile(&stats->hist, 99.9)));
+	} else {
+		fprintf(stdout," %lf %.9lf %.9lf", mbs,
+			NS_TO_S(hist_percentile(&stats->hist, 50)),
+			NS_TO_S(hist_percentile(&stats->hist, 99)));
+	}
+} /* print_fg_phase */
+
+
+/**
+ * Print results of the foreground jobs with and without discards
+ */
+void print_fg(struct definitions *defs) {
+	struct fg_job *job;
+	int i;
+
+	for (i = 0; i < defs->nfg; i++) {
+		job = &defs->fg[i];
+
+		if (IS_HUMAN(defs->flags)) {
+			fprintf(stdout,"fg %d %s block %llu depth %d "
+				"region %llu:%llu\n", i,
+				job->write ? "write" : "read",
+				job->block_size, job->depth,
+				job->start, job->size);
+		}
+		print_fg_phase(defs, job, &job->on, "on");
+		print_fg_phase(defs, job, &job->off, "off");
+	}
+} /* print_fg */
+
+
+/**
+ * Print results
+ */
+void print_results(
+	struct definitions *defs,
+	struct statistics *stats,
+	const char *name
+	)
+{
+	unsigned i;
+
+	if (IS_HUMAN(defs->flags)) {
+
+		/* Print results */
+		fprintf(stdout,"[+] RESULTS%s%s\n", name ? " " : "",
+			name ? name : "");
+		fprintf(stdout,"timer = %s (overhead %llu ns)\n",
+			timer_name(), (unsigned long long)timer_overhead
+		);
+		fprintf(stdout,"min = %.9lfs\nmax = %.9lfs\navg = %.9lfs\n",
+			NS_TO_S(stats->min), NS_TO_S(stats->max),
+			NS_TO_S(stats->sum)/(double) stats->count
+		);
+		fprintf(stdout,"count = %ld\nsum = %.9lfs\n",
+			stats->count, NS_TO_S(stats->sum)
+		);
+		if ((defs->threads > 1) || (defs->depth > 1) || defs->rate ||
+		    defs->replay) {
+			fprintf(stdout,"threads = %d\nqueue depth = %d\n"
+				"elapsed = %.9lfs\n",
+				defs->threads, defs->depth ? defs->depth : 1,
+				NS_TO_S(stats->elapsed)
+			);
+		}
+		fprintf(stdout,"throughput = %lf MB/s\n",
+			get_throughput(defs, stats)
+		);
+		if (IS_FITRIMFS(defs->flags))
+			fprintf(stdout,"minlen = %llu\n", defs->minlen);
+		if (stats->blk.valid)
+			print_blk_stat(defs, stats);
+		if (IS_PERFSTAT(defs->flags))
+			print_perf(defs, stats);
+		if (defs->ranges && stats->ranges) {
+			fprintf(stdout,"ranges = %llu (%d per command)\n"
+				"range avg = %.9lfs\n",
+				(unsigned long long)stats->ranges, defs->ranges,
+				NS_TO_S(stats->sum) / (double)stats->ranges);
+		}
+		for (i = 0; i < NR_PERCENTILES; i++) {
+			fprintf(stdout,"p%g = %.9lfs\n", percentiles[i],
+				NS_TO_S(hist_percentile(&stats->hist,
+							percentiles[i])));
+		}
+		if (defs->conv.relerr && defs->conv.pct) {
+			fprintf(stdout,"precision = %lf%% of p%g\n",
+				get_precision(&defs->conv, stats) * 100,
+				defs->conv.pct);
+		} else if (defs->conv.relerr) {
+			fprintf(stdout,"precision = %lf%% of mean\n",
+				get_precision(&defs->conv, stats) * 100);
+		}
+		if (defs->steady.window && (defs->steady.reached > 0))
+			fprintf(stdout,"steady state = after %d rounds\n",
+				defs->steady.reached);
+		else if (defs->steady.window)
+			fprintf(stdout,"steady state = not reached\n");
+		print_fg(defs);
+
+	} else {
+
+		if (name)
+			fprintf(stdout,"# %s ", name);
+		fprintf(stdout,"%llu %llu %.9lf %.9lf %.9lf %.9lf %lf",
+			defs->record_size,
+			(unsigned long long)stats->bytes,
+			NS_TO_S(stats->min),
+			NS_TO_S(stats->max),
+			NS_TO_S(stats->sum)/(double) stats->count,
+			NS_TO_S(stats->sum),
+			get_throughput(defs, stats)
+		);
+		for (i = 0; i < NR_PERCENTILES; i++) {
+			fprintf(stdout," %.9lf",
+				NS_TO_S(hist_percentile(&stats->hist,
+							percentiles[i])));
+		}
+		if (defs->conv.relerr)
+			fprintf(stdout," %lf",
+				get_precision(&defs->conv, stats) * 100);
+		print_fg(defs);
+		if (IS_FITRIMFS(defs->flags))
+			fprintf(stdout," %llu", defs->minlen);
+		if (defs->ranges)
+			fprintf(stdout," %d %.9lf", defs->ranges,
+				stats->ranges ? NS_TO_S(stats->sum) /
+				(double)stats->ranges : 0);
+		if (stats->blk.valid)
+			print_blk_stat(defs, stats);
+		if (IS_PERFSTAT(defs->flags))
+			print_perf(defs, stats);
+		if (defs->steady.window)
+			fprintf(stdout," %d", defs->steady.reached);
+		fprintf(stdout,"\n");
+	}
+} /* print results */
+
+/**
+ * Run single ioctl test defined by structure defs
+ * and collect the results into stats
+ */
+int test_step(struct definitions *defs, struct statistics *stats) {
+	uint64_t time_start, time_stop;
+	struct blk_stat before, after;
+	struct perf perf;
+	int i, err;
+
+	/* initialize statistic structure */
+	init_stats(stats);
+
+	/* foreground jobs run along with the discards */
+	if (defs->nfg && (start_fg(defs, 1) == -1)) {
+		return -1;
+	}
+
+	get_blk_stat(defs->blk_dev, &before);
+
+	/* counters are inherited by the workers created by run_ioctl() */
+	if (IS_PERFSTAT(defs->flags)) {
+		perf_open(&perf);
+		perf_start(&perf);
+	}
+
+	/* start timer */
+	time_start = timer_now();
+	defs->conv.start = time_start;
+	defs->conv.next_check = CONVERGE_CHECK;
+
+	err = run_ioctl(defs, stats);
+
+	/* stop timer */
+	time_stop = timer_now();
+
+	if (IS_PERFSTAT(defs->flags)) {
+		perf_stop(&perf, &stats->perf);
+		perf_close(&perf);
+	}
+
+	get_blk_stat(defs->blk_dev, &after);
+	diff_blk_stat(&stats->blk, &before, &after);
+
+	if (defs->nfg && (stop_fg(defs) == -1)) {
+		err = 1;
+	}
+
+	if (err) {
+		return -1;
+	} 
+
+	stats->elapsed = timer_ns(time_stop - time_start);
+
+	/* and then alone for the same time */
+	if (defs->nfg) {
+		for (i = 0; i < defs->nfg; i++)
+			defs->fg[i].on.elapsed = stats->elapsed;
+		if (run_fg_alone(defs, stats->elapsed) == -1)
+			return -1;
+		for (i = 0; i < defs->nfg; i++)
+			defs->fg[i].off.elapsed = stats->elapsed;
+	}
+
+	return 0;
+
+} /* test_step */
+
+
+/**
+ * Discard part of the device or whole device if the
+ * randomio flag is set
+ */
+int discard_whole_device(struct definitions *defs) {
+	uint64_t range[2];
+
+	/* with the working set only that is used */
+	range[0] = defs->win_start;
+	range[1] = defs->win_size;
+
+	/* null and simulated devices have nothing to discard */
+	if (defs->op->nodev)
+		return 0;
+
+	/* trim all free space of the filesystem */
+	if (IS_FITRIMFS(defs->flags)) {
+		struct fstrim_range trim = {0, ULLONG_MAX, 0};
+
+		if (ioctl(defs->fd, FITRIM, &trim) == -1) {
+			perror("Ioctl FITRIM");
+			return -1;
+		}
 		return 0;
 	}
-	if ((rec->step = get_number(&opt)) == 0) {
+
+	/* files have no discard, punching the hole frees them */
+	if (defs->regular) {
+		if (defs->op->issue(defs->fd, range) == -1) {
+			perror(defs->op->call);
+			return -1;
+		}
 		return 0;
 	}
 
-	if ((rec->start > rec->end) || 
-	   ((rec->start + rec->step) > rec->end) ||
-	   (rec->step == 0))
-	{
-		fprintf(stderr,"Insane record range: %llu:%llu:%llu\n",
-			rec->start,rec->end,rec->step);
+	if (ioctl(defs->fd, BLKDISCARD, &range) == -1) {
+		/* other operations may be tested without discard */
+		if ((errno == EOPNOTSUPP) &&
+		    (strcmp(defs->op->name, "discard") != 0)) {
+			fprintf(stderr,"Warning: %s can not be discarded "
+				"before the test\n", defs->target);
+			return 0;
+		}
+		perror("Ioctl BLKDISCARD");
+		return -1;
+	}
+
+	return 0;
+} /* discard_whole_device */
+
+/**
+ * Open the device and get infos about it
+ */
+int open_device(struct definitions *defs) {
+	struct stat sb;
+	
+	if ((defs->fd = open_target(defs)) == -1) {
+		perror("Opening block device");
+		return -1;
+	}
+
+	/* whole filesystem is trimmed in the units of its blocks */
+	if (IS_FITRIMFS(defs->flags)) {
+		struct statvfs vfs;
+
+		if (fstatvfs(defs->fd, &vfs) == -1) {
+			perror("fstatvfs");
+			close(defs->fd);
+			return -1;
+		}
+		defs->dev_size = (unsigned long long)vfs.f_blocks * vfs.f_frsize;
+		defs->dev_ssize = vfs.f_bsize;
+		memset(&defs->limits, 0, sizeof(defs->limits));
+		return 0;
+	}
+
+	/* regular file is tested in the units of its blocks */
+	if (defs->regular) {
+		if (fstat(defs->fd, &sb) == -1) {
+			perror("fstat");
+			close(defs->fd);
+			return -1;
+		}
+		defs->dev_size = sb.st_size;
+		defs->dev_ssize = sb.st_blksize;
+		memset(&defs->limits, 0, sizeof(defs->limits));
 		return 0;
 	}
 
-	return 1;
-} /* get_range */
+	if ((defs->dev_size = get_device_size(defs->fd)) == 0) {
+		close(defs->fd);
+		return -1;
+	}
+
+	if ((defs->dev_ssize = get_sector_size(defs->fd)) == 0) {
+		close(defs->fd);
+		return -1;
+	}
+
+	get_discard_limits(defs->fd, &defs->limits);
+
+	return 0;
+} /* open_device */
+
+
+/**
+ * Basic check of parameters sanity
+ */
+int check_sanity(struct definitions *defs) {
+
+	if (defs->total_size % defs->dev_ssize) {
+		fprintf(stderr,"Total size must be aligned to the sector size\n");
+		return -1;
+	}
+
+	if (defs->record_size % defs->dev_ssize) {
+		fprintf(stderr,"Record size must be aligned to the sector size\n");
+		return -1;
+	}
+
+	if (defs->start % defs->dev_ssize) {
+		fprintf(stderr,"Starting point must be aligned to the sector size\n");
+		return -1;
+	}
+
+	/* check boundaries */
+	if ((defs->start + defs->total_size) > defs->dev_size) {
+		fprintf(stderr,"Boundaries does not fit in the device\n");
+		return -1;
+	}
+
+	if ((defs->win_start % defs->dev_ssize) ||
+	    (defs->win_size % defs->dev_ssize) ||
+	    (defs->win_start + defs->win_size > defs->dev_size)) {
+		fprintf(stderr,"Working set does not fit in the device "
+			"or is not aligned to the sector size\n");
+		return -1;
+	}
+
+	if (IS_RANDOMIO(defs->flags) && (defs->total_size > defs->win_size)) {
+		fprintf(stderr,"Total size does not fit in the working set\n");
+		return -1;
+	}
+
+	if (defs->replay && ((defs->replay->end > defs->dev_size) ||
+	    (defs->replay->start % defs->dev_ssize) ||
+	    (defs->replay->end % defs->dev_ssize))) {
+		fprintf(stderr,"Replayed discards do not fit in the device "
+			"or are not aligned to the sector size\n");
+		return -1;
+	}
+
+	return 0;
+} /* check_sanity */
 
 
 /**
- * Determine device size to avoid issuing discard command
- * out of the device size.
+ * Print the discard limits of the device
  */
-unsigned long long
-get_device_size(const int fd) {
-	uint64_t nblocks;
-
-/*
- *BLKBSZGET - logical block size
- *BLKSSZGET - hw block size
- *BLKGETSIZE - return device size /512 (long *arg) 
- *BLKGETSIZE64 - return device size in bytes (u64 *arg) 
- * */
+void print_limits(struct definitions *defs) {
+	struct discard_limits *l = &defs->limits;
 
-	if (ioctl(fd, BLKGETSIZE64,&nblocks) == -1) {
-		perror("Ioctl block device");
-		return 0;
+	if (IS_HUMAN(defs->flags)) {
+		fprintf(stdout,"[+] Discard limits of %s\n"
+			"Granularity: %llu\nAlignment: %llu\n"
+			"Max bytes: %llu\nMax hw bytes: %llu\n"
+			"Zeroes data: %llu\n", defs->target,
+			l->granularity, l->alignment, l->max_bytes,
+			l->max_hw_bytes, l->zeroes_data);
+	} else {
+		fprintf(stdout,"# limits %s granularity %llu alignment %llu "
+			"max_bytes %llu max_hw_bytes %llu zeroes_data %llu\n",
+			defs->target, l->granularity, l->alignment,
+			l->max_bytes, l->max_hw_bytes, l->zeroes_data);
 	}
+} /* print_limits */
 
-	return (unsigned long long)nblocks;
-} /* get_device_size */
+
+/**
+ * Move the start to the next discard granule boundary
+ */
+unsigned long long align_start(
+	struct discard_limits *l,
+	unsigned long long start)
+{
+	unsigned long long gran = l->granularity;
+
+	if (gran == 0)
+		return start;
+	if (start <= l->alignment)
+		return l->alignment;
+
+	return l->alignment + (start - l->alignment + gran - 1) / gran * gran;
+} /* align_start */
 
 
 /**
- * Determine device sector size
+ * Warn about discards which the kernel will split or round, because
+ * the results would not be for the discards we think we issue
  */
-int get_sector_size(const int fd) {
-	int ssize;
+void check_limits(struct definitions *defs) {
+	struct discard_limits *l = &defs->limits;
+
+	if (l->max_bytes && (defs->record_size > l->max_bytes)) {
+		fprintf(stderr,"Warning: %s: record size %llu is bigger than "
+			"discard_max_bytes %llu, every discard is split into "
+			"%llu\n", defs->target, defs->record_size,
+			l->max_bytes, (defs->record_size + l->max_bytes - 1)
+			/ l->max_bytes);
+	}
 
-	if (ioctl(fd, BLKSSZGET, &ssize) == -1) {
-		perror("Ioctl block device");
-		return 0;
+	if (l->granularity == 0)
+		return;
+
+	if (defs->record_size % l->granularity) {
+		fprintf(stderr,"Warning: %s: record size %llu is not a "
+			"multiple of discard_granularity %llu\n",
+			defs->target, defs->record_size, l->granularity);
+	} else if (!IS_RANDOMIO(defs->flags) &&
+		   ((defs->start < l->alignment) ||
+		    ((defs->start - l->alignment) % l->granularity))) {
+		fprintf(stderr,"Warning: %s: start %llu is not aligned to "
+			"discard_granularity %llu\n",
+			defs->target, defs->start, l->granularity);
 	}
+} /* check_limits */
 
-	return ssize;
-} /* get sector size */
+
+/**
+ * Path of the i-th fragmenting file in the tested filesystem
+ */
+void frag_path(
+	struct definitions *defs,
+	char *path,
+	unsigned i)
+{
+	if (i == (unsigned)-1)
+		snprintf(path, FRAG_PATH, "%s/.test-discard", defs->target);
+	else
+		snprintf(path, FRAG_PATH, "%s/.test-discard/%08u",
+			 defs->target, i);
+} /* frag_path */
 
 
 /**
- * Get some random data to put on the device
+ * Remove all fragmenting files
  */
-int get_entropy(char *entropy, int size) {
-	int ent_fd;
-	
-	if ((ent_fd = open("/dev/urandom",O_RDONLY)) == -1) {
-		perror("Opening urandom device");
-		return -1;
-	}
+void remove_fragments(struct definitions *defs) {
+	char path[FRAG_PATH];
+	unsigned i, nfiles;
 
-	read(ent_fd,entropy,size);
-	close(ent_fd);
+	if (defs->frag_size == 0)
+		return;
 
-	return 0;
-} /* get_entropy */
+	nfiles = defs->frag_amount / defs->frag_size;
+	for (i = 0; i < nfiles; i++) {
+		frag_path(defs, path, i);
+		unlink(path);
+	}
+	frag_path(defs, path, -1);
+	rmdir(path);
+} /* remove_fragments */
 
 
 /**
- * Write defined amount of pseudorandom  data to the device
+ * Fragment free space of the filesystem the same way before every
+ * step: write frag_amount of data into frag_size files, then remove
+ * every other file, so there are free extents of frag_size between
+ * the used ones. Removed space is trimmed by the next FITRIM.
  */
-int write_data(int fd, uint64_t start, uint64_t size) {
-	char entropy[ENT_SIZE];
-	ssize_t step;
-	int64_t total;
+int fragment_fs(struct definitions *defs) {
+	char path[FRAG_PATH];
+	unsigned long long done, size;
+	unsigned i, nfiles;
+	uint64_t time_start;
+	char *buf;
+	ssize_t ret;
+	int fd;
 
-	if (get_entropy(entropy,ENT_SIZE) == -1) {
-		fprintf(stderr,"Error while gathering entropy\n");
+	nfiles = defs->frag_amount / defs->frag_size;
+	size = defs->frag_size < defs->prep_buf ?
+	       defs->frag_size : defs->prep_buf;
+
+	if ((buf = malloc(size)) == NULL) {
+		perror("malloc");
 		return -1;
 	}
-
-	if (lseek64(fd,(off64_t)start,SEEK_SET) == -1) {
-		perror("write_data lseek");
+	if (get_entropy(buf, size) == -1) {
+		free(buf);
 		return -1;
 	}
 
-	total = (int64_t)((size / (double)ENT_SIZE) + 0.5);
+	time_start = timer_now();
 
-	while (total) {
-		total--;
+	remove_fragments(defs);
+	frag_path(defs, path, -1);
+	if (mkdir(path, 0700) == -1) {
+		perror("mkdir");
+		free(buf);
+		return -1;
+	}
 
-		if ((step = write(fd,entropy,ENT_SIZE)) == -1) {
-			if (errno == ENOSPC) {
-				continue;
-			}
-			perror("write_data write");
+	for (i = 0; i < nfiles; i++) {
+		frag_path(defs, path, i);
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+			perror("Creating fragmenting file");
+			free(buf);
 			return -1;
 		}
 
-		if (step < (ssize_t)ENT_SIZE) {
-			fprintf(stderr,"write_data: Written size is "
-				"smaller than expected\n");
-			return -1;
+		for (done = 0; done < defs->frag_size; done += ret) {
+			ret = defs->frag_size - done;
+			if ((unsigned long long)ret > size)
+				ret = size;
+			if ((ret = write(fd, buf, ret)) <= 0) {
+				perror("Writing fragmenting file");
+				close(fd);
+				free(buf);
+				return -1;
+			}
 		}
+		close(fd);
+	}
+	free(buf);
+
+	/* allocate all of them first, then free every other one */
+	sync();
+	for (i = 0; i < nfiles; i += 2) {
+		frag_path(defs, path, i);
+		unlink(path);
 	}
+	sync();
 
-	fsync(fd);
+	if (IS_HUMAN(defs->flags))
+		fprintf(stdout,"Fragmented free space into %u holes of %llu "
+			"bytes in %lfs\n", (nfiles + 1) / 2, defs->frag_size,
+			NS_TO_S(timer_ns(timer_now() - time_start)));
+	else
+		fprintf(stdout,"# fragmented %u holes of %llu bytes in %lf s\n",
+			(nfiles + 1) / 2, defs->frag_size,
+			NS_TO_S(timer_ns(timer_now() - time_start)));
 
 	return 0;
-} /* write data */
+} /* fragment_fs */
 
 
 /**
- * Write some data to the device in order to prevent
- * discarding already discarded blocks
+ * Set the working set of random IO, which is the whole device unless
+ * it was given by [-W]. Random placement is aligned to WINDOW_ALIGN.
  */
-int prepare_device (struct definitions *defs) {
-	uint64_t total;
+int set_window(struct device *dev) {
+	struct definitions *defs = &dev->defs;
+	unsigned long long slots;
+	struct prng rng;
+
+	if (defs->win_size == 0) {
+		defs->win_start = 0;
+		defs->win_size = defs->dev_size;
+		return 0;
+	}
 
-	if (IS_RANDOMIO(defs->flags)) {
-		defs->start = 0;
-		total = defs->dev_size;
+	if (defs->win_size > defs->dev_size) {
+		fprintf(stderr,"Working set is bigger than %s\n",
+			defs->target);
+		return -1;
+	}
+
+	if (defs->win_random) {
+		slots = (defs->dev_size - defs->win_size) / WINDOW_ALIGN + 1;
+		prng_seed(&rng, defs->seed + defs->worker);
+		defs->win_start = prng_bounded(&rng, slots) * WINDOW_ALIGN;
+	}
+
+	if (IS_HUMAN(defs->flags))
+		fprintf(stdout,"[+] Working set of %s: %llu bytes at %llu\n",
+			defs->target, defs->win_size, defs->win_start);
+	else
+		fprintf(stdout,"# window %s %llu %llu\n", defs->target,
+			defs->win_start, defs->win_size);
+	return 0;
+} /* set_window */
+
+
+/**
+ * Open and check the tested device, and discard it as a whole
+ */
+int setup_device(struct device *dev) {
+	struct definitions *defs = &dev->defs;
+	struct stat sb;
+
+	if (stat(defs->target,&sb) == -1) {
+		perror("stat");
+		fprintf(stderr,"%s is not a valid device\n", defs->target);
+		return -1;
+	}
+
+	if (IS_FITRIMFS(defs->flags)) {
+		if (!S_ISDIR(sb.st_mode)) {
+			fprintf(stderr,"%s is not a directory\n",
+				defs->target);
+			return -1;
+		}
 	} else {
-		total = defs->total_size;
+		defs->regular = S_ISREG(sb.st_mode) && defs->op->files;
+		if (!S_ISBLK(sb.st_mode) && !defs->regular) {
+			fprintf(stderr,"%s is not a valid device\n",
+				defs->target);
+			return -1;
+		}
+	}
+
+	/* files and filesystems are discarded by the device they are on */
+	defs->blk_dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+
+	/* open device */	
+	if (open_device(defs) == -1) {
+		return -1;
+	}
+
+	/* DSM commands go straight to the namespace */
+	if (defs->ranges && (nvme_ns_open(&defs->ns, defs->fd) == -1)) {
+		perror("Opening NVMe namespace");
+		fprintf(stderr,"%s is not an NVMe namespace\n", defs->target);
+		close(defs->fd);
+		return -1;
+	}
+
+	if (!defs->regular && !IS_FITRIMFS(defs->flags) &&
+	    (defs->limits.max_bytes == 0) &&
+	    strstr(defs->op->name, "discard"))
+		fprintf(stderr,"Warning: %s does not seem to support "
+			"discard\n", defs->target);
+
+	if (IS_AUTOALIGN(defs->flags) && !IS_RANDOMIO(defs->flags) &&
+	    (align_start(&defs->limits, defs->start) != defs->start)) {
+		defs->start = align_start(&defs->limits, defs->start);
+		if (IS_HUMAN(defs->flags))
+			fprintf(stdout,"[+] Start of %s aligned to %llu\n",
+				defs->target, defs->start);
+	}
+
+	if (set_window(dev) == -1 || check_sanity(defs) == -1) {
+		close(defs->fd);
+		return -1;
+	}
+
+	/* Initial discard */
+	if (IS_HUMAN(defs->flags) && !defs->resumed && !defs->op->nodev) {
+		fprintf(stdout,"[+] Discarding device %s\n", defs->target);
+	}
+	if (!defs->resumed && (discard_whole_device(defs) == -1)) {
+		close(defs->fd);
+		return -1;
+	}
+
+	if (defs->precond_passes && !defs->op->nodev && !defs->resumed &&
+	    (precondition_device(defs) == -1)) {
+		close(defs->fd);
+		return -1;
 	}
 
-#ifndef DEBUG_NO_PREPARE
-	return write_data(defs->fd,defs->start,total);
-#else
+	dev->plan.base = defs->start;
+	dev->plan.total = defs->total_size;
+	dev->plan.next = dev->plan.end = defs->start;
+
 	return 0;
-#endif
-} /* prepare_device */
+} /* setup_device */
 
 
 /**
- * Overwrite only discarded blocks.
- * Instead of overwriting whole disk with random
- * data in order to prevent discarding already discarded
- * blocks, simply overwrite only data discarded in 
- * previous step - this information is stored in the 
- * DISCARDED_LIST
+ * Get the device ready for the step with given record size: write
+ * again what the previous step discarded and set up the tracker
  */
-int prepare_by_tree(struct definitions *defs) {
-	struct rb_node *node;
-	struct discarded_entry *entry, *prev = NULL;
-	char entropy[ENT_SIZE];
-	unsigned long long total;
+int prepare_step(struct device *dev) {
+	struct definitions *defs = &dev->defs;
+	struct sweep *sweep = dev->sweep;
+	unsigned i = dev->step;
+
+	/* in random IO mode the whole device is prepared only once,
+	 * then just what the previous step (or round of the step, or
+	 * the checkpointed run) discarded, which is known by the
+	 * tracker in units of the previous record size */
+	if (IS_RANDOMIO(defs->flags) && !IS_DISCARD2(defs->flags) &&
+	    defs->tracker) {
+		if (IS_HUMAN(defs->flags) && !IS_NOPREPARE(defs->flags)) {
+			fprintf(stdout,"[+] Preparing device\n");
+		}
+		if (prepare_by_tree(defs) == -1) {
+			return -1;
+		}
+	}
 
-	get_entropy(entropy,ENT_SIZE);
+	/* the trace is replayed as it is, the records of the step are
+	 * its discards and the record size is their mean length */
+	if (defs->replay) {
+		defs->record_size = defs->replay->bytes / defs->replay->count;
+		defs->total_size = defs->replay->count * defs->record_size;
+		if (!IS_DISCARD2(defs->flags)) {
+			if (IS_HUMAN(defs->flags) &&
+			    !IS_NOPREPARE(defs->flags)) {
+				fprintf(stdout,"[+] Preparing device\n");
+			}
+			if (prepare_replay(defs) == -1) {
+				return -1;
+			}
+		}
+		check_limits(defs);
+		return 0;
+	}
 
-	for (node = rb_first(&discarded_root); node; node = rb_next(node)) {
-		entry = rb_entry(node, struct discarded_entry, node);
+	switch (defs->sweep_by) {
+	case SWEEP_MINLEN:
+		defs->minlen = sweep->sizes[i];
+		break;
+	case SWEEP_RANGES:
+		defs->ranges = sweep->sizes[i];
+		break;
+	default:
+		defs->record_size = step_record(defs, sweep->sizes[i]);
+		break;
+	}
 
-		total = (entry->count * defs->record_size);
+	/* round total size to the multiple of the record_size */
+	defs->total_size = step_size(defs, &dev->plan, defs->record_size);
 
-		if (total == 0) {
-			fprintf(stderr, "Programming error: total = %llu\n",
-				total);
-			crit_err();
+	/* Prepare device if we are not in the DISCARD2 mode */
+	if (IS_FITRIMFS(defs->flags)) {
+		if (defs->frag_size && !IS_DISCARD2(defs->flags))
+			return fragment_fs(defs);
+		return 0;
+	} else if (IS_DISCARD2(defs->flags)) {
+		/* nothing to prepare */
+	} else if (IS_PLANSWEEP(defs->flags) &&
+		   !IS_RANDOMIO(defs->flags)) {
+		if (plan_step(defs, &dev->plan, sweep->sizes + i + 1,
+			      sweep->n - i - 1) == -1) {
+			return -1;
+		}
+	} else if (!IS_RANDOMIO(defs->flags) || (defs->tracker == NULL)) {
+		
+		if (IS_HUMAN(defs->flags) && !IS_NOPREPARE(defs->flags)) {
+			fprintf(stdout,"[+] Preparing device\n");
 		}
+		
+		if (prepare_device(defs) == -1) {
+			return -1;
+		}
+	}
 
-		if (prev && (prev->start + prev->count >= entry->start)) {
-			fprintf(stderr, "Programming error tree is corrupted:\n"
-					" prev %llu->%llu(%llu)\n"
-					" cur %llu->%llu(%llu)\n",
-					prev->start, prev->start + prev->count,
-					prev->count, entry->start,
-					entry->start + entry->count,
-					entry->count);
-			crit_err();
+	check_limits(defs);
+	
+	/* Initialize tracker in random IO mode */
+	if (IS_RANDOMIO(defs->flags)) {
+		if (defs->tracker == NULL) {
+			defs->tracker = tracker_create(defs->tracker_name,
+				defs->win_size / defs->record_size,
+				defs->seed);
+			if (defs->tracker == NULL) {
+				return -1;
+			}
+		} else if (tracker_reset(defs->tracker,
+			   defs->win_size / defs->record_size) == -1) {
+			return -1;
 		}
 
-#ifndef DEBUG_NO_PREPARE
-		if (write_data(defs->fd,
-		    (entry->start * defs->record_size),total) == -1) {
+		if ((defs->pattern == NULL) &&
+		    ((defs->pattern = pattern_create(&defs->pattern_conf,
+						     defs->seed + 1)) == NULL)) {
+			return -1;
+		}
+		if (pattern_reset(defs->pattern, defs->tracker,
+				  defs->record_size) == -1) {
 			return -1;
 		}
-#endif
-		prev = entry;
 	}
-	fsync(defs->fd);
 
 	return 0;
-} /* prepare_by_tree */
+} /* prepare_step */
+
+
+void *prepare_thread(void *arg) {
+	struct device *dev = (struct device *)arg;
+
+	dev->err = prepare_step(dev);
+	return NULL;
+} /* prepare_thread */
+
+
+void *test_thread(void *arg) {
+	struct device *dev = (struct device *)arg;
+
+	dev->err = test_step(&dev->defs, &dev->stats);
+	return NULL;
+} /* test_thread */
 
 
 /**
- * Print results
+ * Run fn for all devices in parallel, each of them in its own thread
  */
-void print_results(
-	struct definitions *defs,
-	struct statistics *stats
-	)
+int for_each_device(
+	struct device *devs,
+	int ndevs,
+	void *(*fn)(void *))
 {
-	if (IS_HUMAN(defs->flags)) {
+	int i, started, err = 0;
 
-		/* Print results */
-		fprintf(stdout,"[+] RESULTS\nmin = %lfs\nmax = %lfs\navg = %lfs\n",
-			stats->min, stats->max, 
-			stats->sum/(double) stats->count
-		);
-		fprintf(stdout,"count = %ld\nsum = %lfs\nthroughput = %lf MB/s\n",
-			stats->count, stats->sum,
-			(defs->total_size/(1024*1024))/stats->sum
-		);
+	if (ndevs == 1) {
+		fn(&devs[0]);
+		return devs[0].err;
+	}
 
-	} else {
+	for (started = 0; started < ndevs; started++) {
+		if ((errno = pthread_create(&devs[started].thread, NULL,
+		     fn, &devs[started])) != 0) {
+			perror("pthread_create");
+			stop = 1;
+			err = -1;
+			break;
+		}
+	}
 
-		fprintf(stdout,"%llu %llu %lf %lf %lf %lf %lf\n",
-			defs->record_size,
-			defs->total_size,
-			stats->min,
-			stats->max,
-			stats->sum/(double) stats->count,
-			stats->sum,
-			(defs->total_size/(1024*1024))/stats->sum
-		);
+	for (i = 0; i < started; i++) {
+		pthread_join(devs[i].thread, NULL);
+		if (devs[i].err)
+			err = -1;
 	}
-} /* print results */
+
+	return err;
+} /* for_each_device */
+
 
 /**
- * Run single ioctl test defined by structure defs
- * and print out the results 
+ * Print the header of the test step
+ */
+void print_header(struct device *devs, int ndevs) {
+	struct definitions *defs = &devs[0].defs;
+	int i;
+
+	fprintf(stdout,"\n[+] Running test\n");
+	if (ndevs == 1) {
+		fprintf(stdout,"Start: %llu\nRecord size: %llu\n"
+			"Total size: %llu\n",
+			defs->start,defs->record_size,defs->total_size);
+	} else {
+		fprintf(stdout,"Record size: %llu\n", defs->record_size);
+		for (i = 0; i < ndevs; i++)
+			fprintf(stdout,"Device: %s Start: %llu "
+				"Total size: %llu\n", devs[i].defs.target,
+				devs[i].defs.start, devs[i].defs.total_size);
+	}
+	fprintf(stdout,"Threads: %d\n", defs->threads);
+	if (IS_FITRIMFS(defs->flags))
+		fprintf(stdout,"Operation: FITRIM\nMinlen: %llu\n",
+			defs->minlen);
+	else
+		fprintf(stdout,"Operation: %s\n", defs->op->name);
+	if (defs->ranges)
+		fprintf(stdout,"Engine: nvme dsm\nRanges: %d\n",
+			defs->ranges);
+	else
+		fprintf(stdout,"Engine: %s\n",
+			defs->depth ? "io_uring" : "ioctl");
+	if (defs->rate)
+		fprintf(stdout,"Rate: %llu %s\n", defs->rate,
+			defs->rate_bytes ? "bytes/s" : "ops/s");
+	if (defs->replay)
+		fprintf(stdout,"Replay: %llu discards in %lfs, time scale "
+			"%lf\n", (unsigned long long)defs->replay->count,
+			NS_TO_S(defs->replay->duration), defs->replay_scale);
+	if (IS_RANDOMIO(defs->flags))
+		fprintf(stdout,"Pattern: %s\nSeed: %llu\n",
+			pattern_name(defs->pattern_conf.type),
+			(unsigned long long)defs->seed);
+	fprintf(stdout,"\n");
+} /* print_header */
+
+
+/**
+ * Run one round of the step on all devices at once and return the
+ * throughput of all of them together. With print the results of
+ * every device and of all of them together are printed.
  */
-int test_step(struct definitions *defs) {
-	double time;
-	struct timeval tv_start, tv_stop;
+int step_round(
+	struct device *devs,
+	int ndevs,
+	int print,
+	double *tput)
+{
+	struct definitions all;
 	struct statistics stats;
-	int err;
+	unsigned long long records = 0;
+	uint64_t time_start, time_stop;
+	int i;
 
-	/* initialize statistic structure */
-	stats.min = INT_MAX; /* This is big enough */
-	stats.max = 0;
-	stats.sum = 0;
-	stats.count = 0;
+	if (for_each_device(devs, ndevs, prepare_thread) == -1)
+		return -1;
 
-	if (IS_HUMAN(defs->flags)) {
+	/* interrupted while preparing, the step is not worth testing */
+	if (stop) {
+		*tput = 0;
+		return 0;
+	}
+
+	if (print && IS_HUMAN(devs[0].defs.flags)) {
+		print_header(devs, ndevs);
 		fprintf(stdout,"[+] Testing\n");
 	}
 
-	/* start timer */
-	if (gettimeofday(&tv_start, (struct timezone *) NULL) == -1) {
-		perror("gettimeofday");
+	/* make room for all records of this step in the trace */
+	for (i = 0; i < ndevs; i++)
+		records += devs[i].defs.total_size / devs[i].defs.record_size;
+	if (devs[0].defs.trace &&
+	    (trace_reserve(devs[0].defs.trace, records) == -1)) {
 		return -1;
 	}
 
-	err = run_ioctl(defs, &stats);
-
-	/* stop timer */
-	if (gettimeofday(&tv_stop, (struct timezone *) NULL) == -1) {
-		perror("gettimeofday");
+	time_start = timer_now();
+	if (for_each_device(devs, ndevs, test_thread) == -1)
 		return -1;
+	time_stop = timer_now();
+
+	if (ndevs == 1) {
+		if (print)
+			print_results(&devs[0].defs, &devs[0].stats, NULL);
+		*tput = get_throughput(&devs[0].defs, &devs[0].stats);
+		return 0;
 	}
 
-	if (err) {
-		return -1;
-	} 
+	/* all devices together, they were running at the same time */
+	init_stats(&stats);
+	for (i = 0; i < ndevs; i++) {
+		if (print)
+			print_results(&devs[i].defs, &devs[i].stats,
+				      devs[i].defs.target);
+		merge_stats(&stats, &devs[i].stats);
+	}
+	stats.elapsed = timer_ns(time_stop - time_start);
+
+	all = devs[0].defs;
+	all.threads *= ndevs;
+	all.nfg = 0;
+	if (print) {
+		if (IS_HUMAN(all.flags))
+			fprintf(stdout,"[+] All %d devices\n", ndevs);
+		print_results(&all, &stats, NULL);
+	}
+	*tput = get_throughput(&all, &stats);
 
-	/* time diff */	
-	time = (double) tv_stop.tv_sec + \
-		(((double) tv_stop.tv_usec) * 0.000001);
+	return 0;
+} /* step_round */
 
-	time -= (double) tv_start.tv_sec + \
-		(((double) tv_start.tv_usec) * 0.000001);
 
-	print_results(defs,&stats);
+/**
+ * Check whether the throughput of the last rounds is steady. The range
+ * of the window and the excursion of the least squares line fitted to
+ * it must both be within their fraction of the window mean.
+ */
+int steady_state(struct steady *st, double *tput, int n) {
+	double mean = 0, min, max, sxy = 0, sxx = 0, x;
+	int i, w = st->window;
 
-	return 0;
+	if (n < w)
+		return 0;
+	tput += n - w;
+
+	min = max = tput[0];
+	for (i = 0; i < w; i++) {
+		mean += tput[i] / w;
+		if (tput[i] < min)
+			min = tput[i];
+		if (tput[i] > max)
+			max = tput[i];
+	}
 
-} /* test_step */
+	for (i = 0; i < w; i++) {
+		x = i - (w - 1) / 2.0;
+		sxy += x * (tput[i] - mean);
+		sxx += x * x;
+	}
+
+	return ((max - min) <= st->range * mean) &&
+	       (fabs(sxy / sxx) * (w - 1) <= st->slope * mean);
+} /* steady_state */
 
 
 /**
- * Discard part of the device or whole device if the
- * randomio flag is set
+ * Run one step of the sweep on all devices at once and print the
+ * results of every device and of all of them together. With the
+ * steady state detection the step is first repeated until its
+ * throughput is steady, then measured once more.
  */
-int discard_whole_device(struct definitions *defs) {
-	uint64_t range[2];
+int sweep_step(
+	struct device *devs,
+	int ndevs,
+	struct sweep *sweep,
+	unsigned step)
+{
+	struct steady *st = &devs[0].defs.steady;
+	double tput[STEADY_MAX_ROUNDS];
+	int i, n, reached = -1;
 
-	range[0] = 0;
-	range[1] = defs->dev_size;
+	for (i = 0; i < ndevs; i++)
+		devs[i].step = step;
 
-#ifndef DEBUG_NO_DISCARD
-	if (ioctl(defs->fd, BLKDISCARD, &range) == -1) {
-		perror("Ioctl BLKDISCARD");
-		return -1;
+	for (n = 0; st->window && (n < STEADY_MAX_ROUNDS) && !stop; ) {
+		if (step_round(devs, ndevs, 0, &tput[n]) == -1)
+			return -1;
+		n++;
+
+		if (IS_HUMAN(devs[0].defs.flags))
+			fprintf(stdout,"[+] Round %d throughput %lf MB/s\n",
+				n, tput[n - 1]);
+		else
+			fprintf(stdout,"# round %d %lf\n", n, tput[n - 1]);
+
+		if (steady_state(st, tput, n)) {
+			reached = n;
+			break;
+		}
 	}
-#endif
 
-	return 0;
-} /* discard_whole_device */
+	if (stop)
+		return 0;
+
+	if (st->window && (reached == -1))
+		fprintf(stderr,"Warning: steady state not reached in %d "
+			"rounds\n", n);
+	for (i = 0; i < ndevs; i++)
+		devs[i].defs.steady.reached = reached;
+
+	return step_round(devs, ndevs, 1, &sweep->tput[step]);
+} /* sweep_step */
 
 /**
- * Open the device and get infos about it
+ * Remember the random IO state at the start of the step. The step is
+ * done again when resumed, so an interrupted one is checkpointed with
+ * this state rather than with where the generators got to.
  */
-int open_device(struct definitions *defs) {
-	
-	if ((defs->fd = open(defs->target, O_RDWR)) == -1) {
-		perror("Opening block device");
+void mark_step(struct device *devs, int ndevs) {
+	struct definitions *defs;
+	int d;
+
+	for (d = 0; d < ndevs; d++) {
+		defs = &devs[d].defs;
+		if (defs->tracker)
+			devs[d].tracker_rng = defs->tracker->rng;
+		if (defs->pattern)
+			devs[d].pattern_rng = defs->pattern->rng;
+	}
+} /* mark_step */
+
+
+/**
+ * Write the state of the sweep before the step into the checkpoint.
+ * The new file replaces the old one only when it is complete, so
+ * being killed while writing it loses only the last step.
+ */
+int save_checkpoint(
+	const char *path,
+	struct device *devs,
+	int ndevs,
+	struct sweep *sweep,
+	unsigned step)
+{
+	struct definitions *defs;
+	struct ckpt_header hdr;
+	struct ckpt_device cd;
+	char tmp[FRAG_PATH];
+	unsigned i;
+	FILE *f;
+	int d;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((f = fopen(tmp, "w")) == NULL) {
+		perror("Opening checkpoint");
 		return -1;
 	}
 
-	if ((defs->dev_size = get_device_size(defs->fd)) == 0) {
-		close(defs->fd);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CKPT_MAGIC;
+	hdr.version = CKPT_VERSION;
+	hdr.ndevs = ndevs;
+	hdr.step = step;
+	hdr.nsizes = sweep->n;
+	hdr.seed = devs[0].defs.seed;
+	hdr.flags = devs[0].defs.flags;
+	hdr.sweep_by = devs[0].defs.sweep_by;
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	for (i = 0; i < sweep->n; i++) {
+		fwrite(&sweep->sizes[i], sizeof(uint64_t), 1, f);
+		fwrite(&sweep->tput[i], sizeof(double), 1, f);
+	}
+
+	for (d = 0; d < ndevs; d++) {
+		defs = &devs[d].defs;
+
+		memset(&cd, 0, sizeof(cd));
+		strncpy(cd.target, defs->target, sizeof(cd.target) - 1);
+		cd.dev_size = defs->dev_size;
+		cd.win_start = defs->win_start;
+		cd.win_size = defs->win_size;
+		cd.record_size = defs->record_size;
+		cd.total_size = defs->total_size;
+		cd.start = defs->start;
+		cd.minlen = defs->minlen;
+		cd.ranges = defs->ranges;
+		cd.tracker = (defs->tracker != NULL);
+		cd.plan = devs[d].plan;
+		cd.pattern_conf = defs->pattern_conf;
+		cd.tracker_rng = devs[d].tracker_rng;
+		cd.pattern_rng = devs[d].pattern_rng;
+		fwrite(&cd, sizeof(cd), 1, f);
+
+		if (defs->tracker && (tracker_save(defs->tracker, f) == -1))
+			break;
+	}
+
+	if ((d < ndevs) || ferror(f) || (fflush(f) == EOF) ||
+	    (fsync(fileno(f)) == -1)) {
+		perror("Writing checkpoint");
+		fclose(f);
+		unlink(tmp);
 		return -1;
 	}
+	fclose(f);
 
-	if ((defs->dev_ssize = get_sector_size(defs->fd)) == 0) {
-		close(defs->fd);
+	if (rename(tmp, path) == -1) {
+		perror("Renaming checkpoint");
+		unlink(tmp);
 		return -1;
 	}
 
 	return 0;
-} /* open_device */
+} /* save_checkpoint */
 
 
 /**
- * Basic check of parameters sanity
+ * Read the checkpoint written by save_checkpoint(), trackers are
+ * created and loaded here, the rest is applied by restore_checkpoint()
  */
-int check_sanity(struct definitions *defs) {
+int load_checkpoint(
+	const char *path,
+	struct checkpoint *ck,
+	const char *tracker_name)
+{
+	struct ckpt_header *hdr = &ck->hdr;
+	unsigned i;
+	FILE *f;
 
-	if (defs->total_size % defs->dev_ssize) {
-		fprintf(stderr,"Total size must be aligned to the sector size\n");
+	memset(ck, 0, sizeof(*ck));
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror("Opening checkpoint");
 		return -1;
 	}
 
-	if (defs->record_size % defs->dev_ssize) {
-		fprintf(stderr,"Record size must be aligned to the sector size\n");
+	if ((fread(hdr, sizeof(*hdr), 1, f) != 1) ||
+	    (hdr->magic != CKPT_MAGIC) || (hdr->version != CKPT_VERSION) ||
+	    (hdr->ndevs == 0) || (hdr->ndevs > MAX_DEVICES) ||
+	    (hdr->nsizes == 0) || (hdr->step > hdr->nsizes)) {
+		fprintf(stderr,"%s is not a checkpoint\n", path);
+		fclose(f);
 		return -1;
 	}
 
-	if (defs->start % defs->dev_ssize) {
-		fprintf(stderr,"Starting point must be aligned to the sector size\n");
-		return -1;
+	ck->sizes = calloc(hdr->nsizes, sizeof(uint64_t));
+	ck->tput = calloc(hdr->nsizes, sizeof(double));
+	ck->devs = calloc(hdr->ndevs, sizeof(struct ckpt_device));
+	ck->trackers = calloc(hdr->ndevs, sizeof(struct tracker *));
+	if (!ck->sizes || !ck->tput || !ck->devs || !ck->trackers) {
+		perror("calloc");
+		goto err;
 	}
 
-	/* check boundaries */
-	if ((defs->start + defs->total_size) > defs->dev_size) {
-		fprintf(stderr,"Boundaries does not fit in the device\n");
-		return -1;
+	for (i = 0; i < hdr->nsizes; i++) {
+		if ((fread(&ck->sizes[i], sizeof(uint64_t), 1, f) != 1) ||
+		    (fread(&ck->tput[i], sizeof(double), 1, f) != 1))
+			goto err_short;
 	}
 
+	for (i = 0; i < hdr->ndevs; i++) {
+		if (fread(&ck->devs[i], sizeof(struct ckpt_device), 1, f) != 1)
+			goto err_short;
+		ck->devs[i].target[PATH_MAX - 1] = '\0';
+
+		if (!ck->devs[i].tracker)
+			continue;
+		ck->trackers[i] = tracker_create(tracker_name, 1, hdr->seed);
+		if ((ck->trackers[i] == NULL) ||
+		    (tracker_load(ck->trackers[i], f) == -1))
+			goto err;
+	}
+
+	fclose(f);
 	return 0;
-} /* check_sanity */
+
+err_short:
+	fprintf(stderr,"Checkpoint %s is truncated\n", path);
+err:
+	for (i = 0; ck->trackers && (i < hdr->ndevs); i++)
+		tracker_destroy(ck->trackers[i]);
+	free(ck->sizes);
+	free(ck->tput);
+	free(ck->devs);
+	free(ck->trackers);
+	fclose(f);
+	return -1;
+} /* load_checkpoint */
+
+
+/**
+ * Continue the checkpointed sweep on the devices which were set up
+ * already, they must be the same as the checkpointed ones
+ */
+int restore_checkpoint(
+	struct checkpoint *ck,
+	struct device *devs,
+	int ndevs,
+	struct sweep *sweep)
+{
+	struct definitions *defs;
+	struct ckpt_device *cd;
+	unsigned i;
+	int d;
+
+	for (d = 0; d < ndevs; d++) {
+		defs = &devs[d].defs;
+		cd = &ck->devs[d];
+
+		if (strcmp(cd->target, defs->target) ||
+		    (cd->dev_size != defs->dev_size) ||
+		    (cd->win_start != defs->win_start) ||
+		    (cd->win_size != defs->win_size)) {
+			fprintf(stderr,"%s is not the checkpointed %s\n",
+				defs->target, cd->target);
+			return -1;
+		}
+
+		if ((cd->pattern_conf.type != defs->pattern_conf.type) ||
+		    (cd->pattern_conf.bytes != defs->pattern_conf.bytes) ||
+		    (cd->pattern_conf.theta != defs->pattern_conf.theta) ||
+		    (cd->pattern_conf.dist != defs->pattern_conf.dist)) {
+			fprintf(stderr,"Pattern of %s is not the "
+				"checkpointed one\n", defs->target);
+			return -1;
+		}
+
+		defs->record_size = cd->record_size;
+		defs->total_size = cd->total_size;
+		defs->start = cd->start;
+		defs->minlen = cd->minlen;
+		defs->ranges = cd->ranges;
+		devs[d].plan = cd->plan;
+
+		/* owned by the device from now on */
+		defs->tracker = ck->trackers[d];
+		ck->trackers[d] = NULL;
+		if (defs->tracker == NULL)
+			continue;
+
+		/*
+		 * the interrupted step picks the same blocks again, the
+		 * pattern is reset for the step by prepare_step()
+		 */
+		defs->tracker->rng = cd->tracker_rng;
+		if ((defs->pattern = pattern_create(&defs->pattern_conf,
+						    defs->seed + 1)) == NULL)
+			return -1;
+		defs->pattern->rng = cd->pattern_rng;
+	}
+
+	sweep->n = 0;
+	for (i = 0; i < ck->hdr.nsizes; i++) {
+		if (sweep_add(sweep, ck->sizes[i]) == -1)
+			return -1;
+		sweep->tput[i] = ck->tput[i];
+	}
+
+	return 0;
+} /* restore_checkpoint */
+
+
+/**
+ * Signals only ask the test to stop, it stops at the next discard
+ * and prints what was measured by then
+ */
+void handle_signal(int sig) {
+	stop = 1;
+} /* handle_signal */
+
+static const struct option long_options[] = {
+	{"seed",	required_argument,	NULL,	OPT_SEED},
+	{"trace",	required_argument,	NULL,	OPT_TRACE},
+	{"interval",	required_argument,	NULL,	OPT_INTERVAL},
+	{"plan",	no_argument,		NULL,	OPT_PLAN},
+	{"adaptive",	required_argument,	NULL,	OPT_ADAPTIVE},
+	{"converge",	required_argument,	NULL,	OPT_CONVERGE},
+	{"min-ops",	required_argument,	NULL,	OPT_MIN_OPS},
+	{"max-ops",	required_argument,	NULL,	OPT_MAX_OPS},
+	{"budget",	required_argument,	NULL,	OPT_BUDGET},
+	{"fg",		required_argument,	NULL,	OPT_FG},
+	{"align",	no_argument,		NULL,	OPT_ALIGN},
+	{"centre",	no_argument,		NULL,	OPT_CENTRE},
+	{"op",		required_argument,	NULL,	OPT_OP},
+	{"fitrim",	no_argument,		NULL,	OPT_FITRIM},
+	{"minlen",	required_argument,	NULL,	OPT_MINLEN},
+	{"fragment",	required_argument,	NULL,	OPT_FRAGMENT},
+	{"ranges",	required_argument,	NULL,	OPT_RANGES},
+	{"rate",	required_argument,	NULL,	OPT_RATE},
+	{"perf",	no_argument,		NULL,	OPT_PERF},
+	{"no-prepare",	no_argument,		NULL,	OPT_NO_PREPARE},
+	{"sim",		required_argument,	NULL,	OPT_SIM},
+	{"pattern",	required_argument,	NULL,	OPT_PATTERN},
+	{"replay",	required_argument,	NULL,	OPT_REPLAY},
+	{"precondition",	required_argument,	NULL,	OPT_PRECONDITION},
+	{"steady",	required_argument,	NULL,	OPT_STEADY},
+	{"checkpoint",	required_argument,	NULL,	OPT_CHECKPOINT},
+	{"resume",	required_argument,	NULL,	OPT_RESUME},
+	{"help",	no_argument,		NULL,	'h'},
+	{NULL,		0,			NULL,	0},
+};
 
 int main (int argc, char **argv) {
-	int c, err;
-	struct stat sb;
+	int c, err, timer = TIMER_RAW;
+	char *endptr;
 	struct definitions defs;
-	struct records rec;
-	unsigned long long repeat, i;
+	struct device *devs;
+	char *targets[MAX_DEVICES];
+	int ndevs = 0, d;
+	struct records rec, mrec, nrec;
+	struct trace trace;
+	char *trace_file = NULL;
+	struct replay replay;
+	char *replay_file = NULL;
+	struct sweep sweep;
+	struct fg_job fg[MAX_FG];
+	struct sim_conf sim;
+	struct checkpoint ck;
+	char *ckpt_file = NULL, *resume_file = NULL;
+	struct sigaction sa;
+	unsigned long count;
+	unsigned i;
 
 	defs.record_size = DEF_REC_SIZE;
 	defs.total_size = DEF_TOT_SIZE;
 	defs.start = 0;
 	defs.flags = 0;
+	defs.threads = 1;
+	defs.depth = 0;
+	defs.prep_buf = DEF_PREP_BUF;
+	defs.prep_depth = DEF_PREP_DEPTH;
+	defs.prep_gap = DEF_PREP_GAP;
+	strcpy(defs.tracker_name, "rbtree");
+	defs.tracker = NULL;
+	memset(&defs.pattern_conf, 0, sizeof(defs.pattern_conf));
+	defs.pattern = NULL;
+	defs.seed = ((uint64_t)time(NULL) << 20) ^ getpid();
+	defs.trace = NULL;
+	defs.worker = 0;
+	defs.interval = 0;
+	memset(&defs.conv, 0, sizeof(defs.conv));
+	defs.fg = fg;
+	defs.nfg = 0;
+	defs.op = op_find("discard");
+	defs.regular = 0;
+	defs.minlen = 0;
+	defs.sweep_by = SWEEP_RECORD;
+	defs.ranges = 0;
+	defs.rate = 0;
+	defs.rate_bytes = 0;
+	defs.replay = NULL;
+	defs.replay_scale = 1;
+	defs.replay_first = 0;
+	defs.replay_base = 0;
+	defs.precond_passes = 0;
+	defs.precond_random = 0;
+	defs.resumed = 0;
+	memset(&defs.steady, 0, sizeof(defs.steady));
+	defs.win_start = 0;
+	defs.win_size = 0;
+	defs.win_random = 0;
+	defs.frag_size = 0;
+	defs.frag_amount = 0;
 	rec.step = 0;
+	sim.latency = 0;
+	sweep.threshold = 0;
+	sweep.sizes = NULL;
+	sweep.tput = NULL;
 
-	while ((c = getopt(argc, argv, "hxzbs:r:t:d:R:")) != EOF) {
+	while ((c = getopt_long(argc, argv, "hxzbs:r:t:d:R:j:q:T:B:p:g:k:W:",
+				long_options, NULL)) != EOF) {
 		switch (c) {
 			case 's': /* starting point */
 				if ((defs.start = get_number(&optarg)) == 0) {
@@ -872,8 +4560,80 @@ int main (int argc, char **argv) {
 					return EXIT_FAILURE;
 				}
 				break;
-			case 'd': /* device name */
-				strncpy(defs.target, optarg, sizeof(defs.target));
+			case 'j': /* number of discard workers */
+				defs.threads = atoi(optarg);
+				if ((defs.threads < 1) ||
+				    (defs.threads > MAX_THREADS)) {
+					fprintf(stderr,"Number of threads must be "
+						"between 1 and %d\n", MAX_THREADS);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'q': /* io_uring queue depth */
+				defs.depth = atoi(optarg);
+				if ((defs.depth < 1) ||
+				    (defs.depth > MAX_DEPTH)) {
+					fprintf(stderr,"Queue depth must be "
+						"between 1 and %d\n", MAX_DEPTH);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'B': /* prep buffer size */
+				defs.prep_buf = get_number(&optarg);
+				if ((defs.prep_buf == 0) ||
+				    (defs.prep_buf % PREP_ALIGN) ||
+				    (defs.prep_buf > INT_MAX)) {
+					fprintf(stderr,"Prep buffer size must be "
+						"a multiple of %d\n", PREP_ALIGN);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'p': /* prep writes in flight */
+				defs.prep_depth = atoi(optarg);
+				if ((defs.prep_depth < 1) ||
+				    (defs.prep_depth > MAX_THREADS)) {
+					fprintf(stderr,"Number of prep writes must "
+						"be between 1 and %d\n", MAX_THREADS);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'g': /* max gap merged when preparing */
+				if (strcmp(optarg, "0") == 0) {
+					defs.prep_gap = 0;
+				} else if ((defs.prep_gap =
+					    get_number(&optarg)) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'k': /* tracker of discarded blocks */
+				strncpy(defs.tracker_name, optarg,
+					sizeof(defs.tracker_name) - 1);
+				defs.tracker_name[sizeof(defs.tracker_name) - 1] = 0;
+				break;
+			case 'T': /* time source */
+				if (strcmp(optarg, "raw") == 0) {
+					timer = TIMER_RAW;
+				} else if (strcmp(optarg, "tsc") == 0) {
+					timer = TIMER_TSC;
+				} else {
+					fprintf(stderr,"Unknown timer %s\n",
+						optarg);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'd': /* device name, can be more of them */
+				if (ndevs == MAX_DEVICES) {
+					fprintf(stderr,"At most %d devices "
+						"are supported\n", MAX_DEVICES);
+					return EXIT_FAILURE;
+				}
+				targets[ndevs++] = optarg;
 				break;
 			case 'h': /* help */
 				usage(argv[0]);
@@ -887,8 +4647,230 @@ int main (int argc, char **argv) {
 				break;
 			case 'x':
 				defs.flags |= RANDOMIO;
-				srandom((unsigned) time(NULL));
-				defs.start = 0;
+				break;
+			case 'W': /* working set of random IO */
+				endptr = optarg;
+				if ((defs.win_size = get_number(&optarg)) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				/* get_number() moves optarg only behind ':' */
+				if (optarg != endptr) {
+					if (strcmp(optarg, "random") != 0) {
+						usage(argv[0]);
+						return EXIT_FAILURE;
+					}
+					defs.win_random = 1;
+				}
+				break;
+			case OPT_TRACE: /* per operation log */
+				trace_file = optarg;
+				break;
+			case OPT_ADAPTIVE: /* refine sweep around knees */
+				errno = 0;
+				sweep.threshold = strtod(optarg, &endptr);
+				if (errno || (*endptr != '\0') ||
+				    (sweep.threshold <= 0)) {
+					fprintf(stderr,"Bad threshold %s\n",
+						optarg);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				sweep.threshold /= 100;
+				break;
+			case OPT_CONVERGE: /* stop when precise enough */
+				errno = 0;
+				defs.conv.relerr = strtod(optarg, &endptr);
+				if (!errno && (*endptr == ':'))
+					defs.conv.pct = strtod(endptr + 1,
+							       &endptr);
+				if (errno || (*endptr != '\0') ||
+				    (defs.conv.relerr <= 0) ||
+				    (defs.conv.pct < 0) ||
+				    (defs.conv.pct >= 100)) {
+					fprintf(stderr,"Bad convergence target "
+						"%s\n", optarg);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				defs.conv.relerr /= 100;
+				break;
+			case OPT_MIN_OPS: /* ops before convergence check */
+			case OPT_MAX_OPS: /* ops limit of the step */
+				errno = 0;
+				count = strtoul(optarg, &endptr, 0);
+				if (errno || (*endptr != '\0') || (count == 0)) {
+					fprintf(stderr,"Bad number of operations "
+						"%s\n", optarg);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				if (c == OPT_MIN_OPS)
+					defs.conv.min_ops = count;
+				else
+					defs.conv.max_ops = count;
+				break;
+			case OPT_OP: /* operation to test */
+				if ((defs.op = op_find(optarg)) == NULL) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_FITRIM: /* batched discard of a filesystem */
+				defs.flags |= FITRIMFS;
+				break;
+			case OPT_MINLEN: /* FITRIM minimal extent length */
+				if (strchr(optarg, ':')) {
+					if (get_range(optarg, &mrec) == 0) {
+						usage(argv[0]);
+						return EXIT_FAILURE;
+					}
+					defs.sweep_by = SWEEP_MINLEN;
+				} else if (strcmp(optarg, "0") == 0) {
+					defs.minlen = 0;
+				} else if ((defs.minlen =
+					    get_number(&optarg)) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_RANGES: /* ranges per NVMe DSM command */
+				if (strchr(optarg, ':')) {
+					if (get_range(optarg, &nrec) == 0) {
+						usage(argv[0]);
+						return EXIT_FAILURE;
+					}
+					defs.sweep_by = SWEEP_RANGES;
+					defs.ranges = nrec.start;
+				} else {
+					defs.ranges = atoi(optarg);
+				}
+				if ((defs.ranges < 1) ||
+				    ((defs.sweep_by == SWEEP_RANGES) ?
+				     nrec.end : (unsigned long long)defs.ranges) >
+				    NVME_DSM_MAX_RANGES) {
+					fprintf(stderr,"Number of ranges must be "
+						"between 1 and %d\n",
+						NVME_DSM_MAX_RANGES);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_PRECONDITION: /* write the device first */
+				if (get_precondition(optarg, &defs) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_STEADY: /* repeat the step until steady */
+				if (get_steady(optarg, &defs.steady) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_CHECKPOINT: /* save the sweep before steps */
+				ckpt_file = optarg;
+				break;
+			case OPT_RESUME: /* continue the checkpointed sweep */
+				resume_file = optarg;
+				break;
+			case OPT_REPLAY: /* replay discards of the trace */
+				replay_file = optarg;
+				if (((endptr = strrchr(optarg, ':')) != NULL) &&
+				    (get_scale(endptr + 1,
+					       &defs.replay_scale) == 0)) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				if (endptr)
+					*endptr = '\0';
+				break;
+			case OPT_PATTERN: /* random IO pattern */
+				if (get_pattern(optarg,
+						&defs.pattern_conf) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				defs.flags |= RANDOMIO;
+				break;
+			case OPT_NO_PREPARE: /* discard what is there */
+				defs.flags |= NOPREPARE;
+				break;
+			case OPT_SIM: /* simulated device */
+				if (get_sim(optarg, &sim) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				defs.op = op_find("sim");
+				break;
+			case OPT_PERF: /* CPU cost of the test */
+				defs.flags |= PERFSTAT;
+				break;
+			case OPT_RATE: /* open loop at the given rate */
+				/* with the unit it is bytes per second */
+				defs.rate_bytes = (*optarg != '\0') &&
+					!isdigit(optarg[strlen(optarg) - 1]);
+				if ((defs.rate = get_number(&optarg)) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_FRAGMENT: /* fragment free space first */
+				/* get_number() moves opt only behind the delimiter */
+				endptr = optarg;
+				if ((defs.frag_size = get_number(&optarg)) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				if ((optarg != endptr) && ((defs.frag_amount =
+				    get_number(&optarg)) == 0)) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_ALIGN: /* align to discard granularity */
+				defs.flags |= AUTOALIGN;
+				break;
+			case OPT_CENTRE: /* test around discard limits */
+				defs.flags |= CENTRESWEEP;
+				break;
+			case OPT_FG: /* foreground I/O along with discards */
+				if (defs.nfg == MAX_FG) {
+					fprintf(stderr,"At most %d foreground "
+						"jobs are supported\n", MAX_FG);
+					return EXIT_FAILURE;
+				}
+				if (get_fg_job(optarg, &fg[defs.nfg]) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				defs.nfg++;
+				break;
+			case OPT_BUDGET: /* time limit of the step */
+				if ((defs.conv.budget =
+				    get_duration(optarg)) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_PLAN: /* prepare once for more steps */
+				defs.flags |= PLANSWEEP;
+				break;
+			case OPT_INTERVAL: /* time series reporting */
+				if ((defs.interval =
+				    get_duration(optarg)) == 0) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPT_SEED: /* seed of the random IO pattern */
+				errno = 0;
+				defs.seed = strtoull(optarg, &endptr, 0);
+				if (errno || (*endptr != '\0')) {
+					fprintf(stderr,"Bad seed %s\n", optarg);
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
 				break;
 			default:
 				usage(argv[0]);
@@ -896,121 +4878,350 @@ int main (int argc, char **argv) {
 		}
 	}
 
-	if (strnlen(defs.target,1) < 1) {
+	if (ndevs == 0) {
 		fprintf(stderr,"You must specify device\n");
 		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 
-	if (stat(defs.target,&sb) == -1) {
-		perror("stat");
-		fprintf(stderr,"%s is not a valid device\n", defs.target);
+	/* in random IO mode [-s] only places the working set */
+	if (defs.win_size && !IS_RANDOMIO(defs.flags)) {
+		fprintf(stderr,"Working set needs random IO pattern [-x]\n");
 		return EXIT_FAILURE;
 	}
+	if (IS_RANDOMIO(defs.flags)) {
+		if (defs.win_size && !defs.win_random)
+			defs.win_start = defs.start;
+		defs.start = 0;
+	}
+
+	/* nothing to prepare when the device is not touched */
+	if (defs.op->nodev)
+		defs.flags |= NOPREPARE;
+
+	if (strcmp(defs.op->name, "sim") == 0) {
+		if (sim.latency == 0) {
+			fprintf(stderr,"Simulated device needs --sim\n");
+			return EXIT_FAILURE;
+		}
+		if (op_sim_setup(sim.dist, sim.latency, sim.depth,
+				 defs.seed) == -1)
+			return EXIT_FAILURE;
+	}
 
-	if (!S_ISBLK(sb.st_mode)) {
-		fprintf(stderr,"%s is not a valid device\n", defs.target);
+	if (defs.depth && (defs.op->prep_sqe == NULL)) {
+		fprintf(stderr,"%s can not be issued through io_uring\n",
+			defs.op->name);
 		return EXIT_FAILURE;
 	}
-	
-	/* open device */	
-	if (open_device(&defs) == -1) {
+
+	if (defs.nfg && (ndevs > 1)) {
+		fprintf(stderr,"Foreground jobs need a single device\n");
 		return EXIT_FAILURE;
 	}
 
-	if (check_sanity(&defs) == -1) {
-		close(defs.fd);
+	if (IS_FITRIMFS(defs.flags) &&
+	    (IS_RANDOMIO(defs.flags) || IS_PLANSWEEP(defs.flags) ||
+	     defs.depth || defs.nfg || strcmp(defs.op->name, "discard"))) {
+		fprintf(stderr,"FITRIM mode can not be combined with -x, -q, "
+			"--plan, --fg or --op\n");
 		return EXIT_FAILURE;
 	}
-	
-	/* Initial discard */
-	if (IS_HUMAN(defs.flags)) {
-		fprintf(stdout,"[+] Discarding device\n");
+
+	if (!IS_FITRIMFS(defs.flags) &&
+	    (defs.minlen || (defs.sweep_by == SWEEP_MINLEN) ||
+	     defs.frag_size)) {
+		fprintf(stderr,"--minlen and --fragment need --fitrim\n");
+		return EXIT_FAILURE;
 	}
-	if (discard_whole_device(&defs) == -1) {
-		close(defs.fd);
+
+	if (defs.ranges && (defs.depth || IS_FITRIMFS(defs.flags) ||
+	    strcmp(defs.op->name, "discard"))) {
+		fprintf(stderr,"--ranges can not be combined with -q, "
+			"--fitrim or --op\n");
 		return EXIT_FAILURE;
 	}
 
-	if (rec.step == 0) {
-		repeat = 1;
-	} else {
-		repeat = ((rec.end - rec.start) / rec.step) + 1;
-		defs.record_size = rec.start;
+	if (defs.rate && (defs.depth || IS_FITRIMFS(defs.flags))) {
+		fprintf(stderr,"--rate can not be combined with -q "
+			"or --fitrim\n");
+		return EXIT_FAILURE;
 	}
 
-	err = 0;
-	for (i = 1;i <= repeat;i++) {
+	if (defs.precond_passes && IS_FITRIMFS(defs.flags)) {
+		fprintf(stderr,"--precondition can not be combined with "
+			"--fitrim\n");
+		return EXIT_FAILURE;
+	}
 
-		/* round total size to the multiple of the record_size */
-		defs.total_size = (unsigned long long)
-			((defs.total_size / (double)defs.record_size) + 0.5);
-		defs.total_size *= (defs.record_size);
+	/* the rounds would discard different parts of the plan */
+	if (defs.steady.window && IS_PLANSWEEP(defs.flags)) {
+		fprintf(stderr,"--steady can not be combined with --plan\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the trace has its own offsets and sizes, and it is one step */
+	if (replay_file &&
+	    (IS_RANDOMIO(defs.flags) || IS_FITRIMFS(defs.flags) ||
+	     IS_PLANSWEEP(defs.flags) || IS_CENTRESWEEP(defs.flags) ||
+	     defs.depth || defs.ranges || defs.rate || rec.step ||
+	     (defs.sweep_by != SWEEP_RECORD) || sweep.threshold)) {
+		fprintf(stderr,"--replay can not be combined with -x, -R, -q, "
+			"--fitrim, --ranges, --rate or the sweep options\n");
+		return EXIT_FAILURE;
+	}
 
-		/* check boundaries */
-		if ((defs.start + defs.total_size) > defs.dev_size) {
-			defs.total_size = defs.dev_size;
+	if (defs.sweep_by != SWEEP_RECORD) {
+		if (rec.step) {
+			fprintf(stderr,"Only one of -R, --minlen and "
+				"--ranges can be a range\n");
+			return EXIT_FAILURE;
+		}
+		if (IS_CENTRESWEEP(defs.flags)) {
+			fprintf(stderr,"--centre needs the [-R] sweep\n");
+			return EXIT_FAILURE;
 		}
+		rec = (defs.sweep_by == SWEEP_MINLEN) ? mrec : nrec;
+	}
 
-		/* Prepare device if we are not in the DISCARD2 mode */
-		if (!IS_DISCARD2(defs.flags)) {
-			
-			if (IS_HUMAN(defs.flags)) {
-				fprintf(stdout,"[+] Preparing device\n");
-			}
-			
-			if ((!IS_RANDOMIO(defs.flags)) || (i == 1)) {
-				if ((err = prepare_device(&defs)) == -1) {
-					break;
-				}
-			}
+	/* fragment the same amount the step trims by default */
+	if (defs.frag_size && (defs.frag_amount == 0))
+		defs.frag_amount = defs.total_size;
+	if (defs.frag_size && (defs.frag_amount < 2 * defs.frag_size)) {
+		fprintf(stderr,"Fragmenting needs at least two files\n");
+		return EXIT_FAILURE;
+	}
+
+	if (defs.conv.max_ops && (defs.conv.min_ops > defs.conv.max_ops)) {
+		fprintf(stderr,"Minimal number of operations is bigger "
+			"than the maximal\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the resumed run checkpoints where it was resumed from */
+	if (resume_file) {
+		if (load_checkpoint(resume_file, &ck,
+				    defs.tracker_name) == -1)
+			return EXIT_FAILURE;
+		if ((ck.hdr.ndevs != (unsigned)ndevs) ||
+		    ((ck.hdr.flags ^ defs.flags) & ~BATCHOUT) ||
+		    (ck.hdr.sweep_by != defs.sweep_by)) {
+			fprintf(stderr,"Checkpoint %s was made with other "
+				"options or devices\n", resume_file);
+			return EXIT_FAILURE;
 		}
-		
-		/* Initialize list in random IO mode */
+		defs.seed = ck.hdr.seed;
+		defs.resumed = 1;
+		if (ckpt_file == NULL)
+			ckpt_file = resume_file;
+	}
+
+	/* stop cleanly on the first signal, the second one kills */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sa.sa_flags = SA_RESTART | SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (timer_init(timer) == -1) {
+		return EXIT_FAILURE;
+	}
+	run_start = timer_now();
+
+	if (replay_file) {
+		if (replay_open(&replay, replay_file) == -1)
+			return EXIT_FAILURE;
+		defs.replay = &replay;
+	}
+
+	if ((devs = calloc(ndevs, sizeof(struct device))) == NULL) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	for (d = 0; d < ndevs; d++) {
+		devs[d].defs = defs;
+		strncpy(devs[d].defs.target, targets[d],
+			sizeof(devs[d].defs.target) - 1);
+		devs[d].defs.worker = d * MAX_THREADS;
+		devs[d].sweep = &sweep;
+		if (setup_device(&devs[d]) == -1) {
+			while (d--)
+				close(devs[d].defs.fd);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* foreground jobs use the only device */
+	for (i = 0; i < (unsigned)defs.nfg; i++) {
+		if (check_fg_job(&devs[0].defs, &fg[i]) == -1) {
+			close(devs[0].defs.fd);
+			return EXIT_FAILURE;
+		}
+	}
+	if (open_fg(&devs[0].defs) == -1) {
+		close_fg(&devs[0].defs);
+		close(devs[0].defs.fd);
+		return EXIT_FAILURE;
+	}
+
+	if (trace_file) {
+		if (trace_open(&trace, trace_file) == -1) {
+			err = -1;
+			goto out;
+		}
+		for (d = 0; d < ndevs; d++)
+			devs[d].defs.trace = &trace;
+	}
+	
+	if (!IS_HUMAN(defs.flags)) {
+		fprintf(stdout,"# timer %s overhead %llu ns\n",
+			timer_name(), (unsigned long long)timer_overhead);
+		fprintf(stdout,"# op %s\n", IS_FITRIMFS(defs.flags) ?
+			"fitrim" : defs.op->name);
+		if (defs.rate)
+			fprintf(stdout,"# rate %llu %s\n", defs.rate,
+				defs.rate_bytes ? "bytes/s" : "ops/s");
+		if (defs.precond_passes)
+			fprintf(stdout,"# precondition %d %s\n",
+				defs.precond_passes,
+				defs.precond_random ? "rand" : "seq");
+		if (defs.steady.window)
+			fprintf(stdout,"# steady %d %lf %lf\n",
+				defs.steady.window, defs.steady.range * 100,
+				defs.steady.slope * 100);
+		if (defs.replay)
+			fprintf(stdout,"# replay %llu discards %llu bytes "
+				"%lf s scale %lf\n",
+				(unsigned long long)replay.count,
+				(unsigned long long)replay.bytes,
+				NS_TO_S(replay.duration), defs.replay_scale);
 		if (IS_RANDOMIO(defs.flags))
-			discarded_root = RB_ROOT;
-		
-		if (IS_HUMAN(defs.flags)) {
-			fprintf(stdout,"\n[+] Running test\n");
-			fprintf(stdout,"Start: %llu\nRecord size: %llu\nTotal size: %llu\n\n",
-				defs.start,defs.record_size,defs.total_size);
+			fprintf(stdout,"# pattern %s\n# seed %llu\n",
+				pattern_name(defs.pattern_conf.type),
+				(unsigned long long)defs.seed);
+	}
+
+	for (d = 0; d < ndevs; d++)
+		print_limits(&devs[d].defs);
+
+	if (sweep_init(&sweep, &rec, defs.record_size) == -1) {
+		err = -1;
+		goto out;
+	}
+
+	for (d = 0; IS_CENTRESWEEP(defs.flags) && (d < ndevs); d++) {
+		if (sweep_centre(&sweep, &rec, &devs[d].defs.limits) == -1) {
+			err = -1;
+			goto out;
+		}
+	}
+
+	if (resume_file &&
+	    (restore_checkpoint(&ck, devs, ndevs, &sweep) == -1)) {
+		err = -1;
+		goto out;
+	}
+
+	err = 0;
+	for (i = resume_file ? ck.hdr.step : 0; !stop; i++) {
+
+		/* all planned steps are done, refine the adaptive sweep */
+		if ((i == sweep.n) &&
+		    ((err = sweep_refine(&sweep, &rec)) <= 0)) {
+			break;
 		}
 
-		/* run test */
-		if ((err = test_step(&defs)) == -1) {
+		mark_step(devs, ndevs);
+		if (ckpt_file &&
+		    (save_checkpoint(ckpt_file, devs, ndevs, &sweep, i) == -1)) {
+			err = -1;
 			break;
 		}
 
-		/* Prepare device if we are not in the DISCARD2 
-		 * mode and we are in random IO mode*/
-		if ((!IS_DISCARD2(defs.flags)) && (IS_RANDOMIO(defs.flags))) {
-			
-			if (IS_HUMAN(defs.flags)) {
-				fprintf(stdout,"[+] Preparing device\n");
-			}
-			
-			if (i <= repeat) {
-				if ((err = prepare_by_tree(&defs)) == -1) {
-					break;
-				}
-			}
+		if ((err = sweep_step(devs, ndevs, &sweep, i)) == -1) {
+			break;
 		}
 
-		/* next boundaries */
-		defs.record_size = rec.start + rec.step * i;
+		/* the step is done again when resumed */
+		if (stop) {
+			if (IS_HUMAN(defs.flags))
+				fprintf(stdout,"[+] Interrupted in step %u, "
+					"its results are partial\n", i + 1);
+			else
+				fprintf(stdout,"# interrupted step %u\n",
+					i + 1);
+			if (ckpt_file && (save_checkpoint(ckpt_file, devs,
+			    ndevs, &sweep, i) == -1)) {
+				err = -1;
+				break;
+			}
+			if (ckpt_file && IS_HUMAN(defs.flags))
+				fprintf(stdout,"[+] Checkpoint %s, continue "
+					"with --resume\n", ckpt_file);
+		}
 	} 
 
-	free_tree();
+	if (sweep.threshold) {
+		if (IS_HUMAN(defs.flags))
+			fprintf(stdout,"[+] Adaptive sweep tested %u "
+				"record sizes\n", sweep.n);
+		else
+			fprintf(stdout,"# adaptive sweep %u steps\n",
+				sweep.n);
+	}
 
-	/* close device */
-	if (close(defs.fd) == -1) {
-		perror("Closing block device");
-		return EXIT_FAILURE;
+out:
+	free(sweep.sizes);
+	free(sweep.tput);
+
+	if (resume_file) {
+		for (d = 0; d < ndevs; d++)
+			tracker_destroy(ck.trackers[d]);
+		free(ck.sizes);
+		free(ck.tput);
+		free(ck.devs);
+		free(ck.trackers);
+	}
+
+	for (d = 0; d < ndevs; d++) {
+		if (devs[d].defs.tracker && IS_HUMAN(defs.flags)) {
+			fprintf(stdout,"[+] Tracker %s peak memory %zu "
+				"bytes\n", defs.tracker_name,
+				tracker_memory(devs[d].defs.tracker));
+		}
+		tracker_destroy(devs[d].defs.tracker);
+		pattern_destroy(devs[d].defs.pattern);
+	}
+
+	if (devs[0].defs.trace) {
+		if (trace.dropped)
+			fprintf(stderr,"Warning: %llu trace records dropped\n",
+				(unsigned long long)trace.dropped);
+		if (trace_close(&trace) == -1)
+			err = -1;
+	}
+
+	close_fg(&devs[0].defs);
+
+	/* close devices */
+	for (d = 0; d < ndevs; d++) {
+		remove_fragments(&devs[d].defs);
+		if (close(devs[d].defs.fd) == -1) {
+			perror("Closing block device");
+			err = -1;
+		}
 	}
+	free(devs);
+
+	if (defs.replay)
+		replay_close(&replay);
 
 	if (err == -1) {
 		return EXIT_FAILURE;
 	}
 
 	return EXIT_SUCCESS;
-} /* main */
+} /* main */
\ No newline at end of file
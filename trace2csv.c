@@ -0,0 +1,104 @@
+/**
+ * (C)2009 Red Hat, Inc., Lukas Czerner <lczerner@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * What it does ?
+ * Convert binary trace written by test-discard --trace into CSV.
+ *
+ * usage:
+ *	trace2csv <trace file>
+ *
+ *	time_ns,offset,length,latency_ns,worker
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "libs/trace.h"
+
+int main (int argc, char **argv) {
+	struct trace_header *hdr;
+	struct trace_rec *recs;
+	struct stat sb;
+	uint64_t i, count;
+	void *map;
+	int fd;
+
+	if (argc != 2) {
+		fprintf(stderr,"%s <trace file>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if ((fd = open(argv[1], O_RDONLY)) == -1) {
+		perror("Opening trace file");
+		return EXIT_FAILURE;
+	}
+
+	if (fstat(fd, &sb) == -1) {
+		perror("stat");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	if (sb.st_size < (off_t)sizeof(struct trace_header)) {
+		fprintf(stderr,"%s is not a trace file\n", argv[1]);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("Mapping trace file");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	hdr = map;
+	if ((hdr->magic != TRACE_MAGIC) ||
+	    (hdr->version != TRACE_VERSION) ||
+	    (hdr->rec_size != sizeof(struct trace_rec))) {
+		fprintf(stderr,"%s is not a trace file\n", argv[1]);
+		munmap(map, sb.st_size);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	/* do not trust the count of a truncated file */
+	count = (sb.st_size - sizeof(*hdr)) / sizeof(struct trace_rec);
+	if (hdr->count < count)
+		count = hdr->count;
+
+	if (hdr->dropped)
+		fprintf(stderr,"Warning: %" PRIu64 " records were dropped\n",
+			hdr->dropped);
+
+	recs = (struct trace_rec *)(hdr + 1);
+	fprintf(stdout,"time_ns,offset,length,latency_ns,worker\n");
+	for (i = 0; i < count; i++) {
+		fprintf(stdout,"%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+			",%u\n", recs[i].time, recs[i].offset, recs[i].length,
+			recs[i].latency, recs[i].worker);
+	}
+
+	munmap(map, sb.st_size);
+	close(fd);
+
+	return EXIT_SUCCESS;
+} /* main */